@@ -4,6 +4,7 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QElapsedTimer>
 #include "filesystem.h"
 
 QColor errorToColor(float error, float minErr, float maxErr)
@@ -14,11 +15,15 @@ QColor errorToColor(float error, float minErr, float maxErr)
     return QColor(r, g, 0);
 }
 
-QVector<QImage> loadImages(const QStringList &paths)
+QVector<QImage> loadImages(const QStringList &paths, QVector<double> *decodeMs)
 {
     QVector<QImage> images;
+    QElapsedTimer timer;
     for (const QString &p : paths) {
+        timer.start();
         QImage img(p);
+        if (decodeMs)
+            decodeMs->append(timer.nsecsElapsed() / 1e6);
         if (!img.isNull())
             images.append(img);
     }
@@ -35,10 +40,33 @@ QStringList verifyPaths(const QStringList &paths)
     return valid;
 }
 
-bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators)
+static QJsonArray matrixToJson(const Eigen::Matrix3d &m)
+{
+    QJsonArray a;
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            a.append(m(r, c));
+    return a;
+}
+
+static Eigen::Matrix3d matrixFromJson(const QJsonArray &a)
+{
+    Eigen::Matrix3d m = Eigen::Matrix3d::Identity();
+    if (a.size() != 9)
+        return m;
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            m(r, c) = a[r * 3 + c].toDouble();
+    return m;
+}
+
+static QByteArray sceneToJson(const QStringList &imagePaths, const QList<LocatorData> &locators,
+                              const QList<CameraData> &cameras, const QString &calibrationProfile)
 {
     QJsonObject root;
     root["format_version"] = 1;
+    if (!calibrationProfile.isEmpty())
+        root["calibration_profile"] = calibrationProfile;
     QJsonArray imgs;
     for (const QString &p : imagePaths)
         imgs.append(p);
@@ -61,21 +89,33 @@ bool saveScene(const QString &path, const QStringList &imagePaths, const QList<L
     }
     root["locators"] = locArr;
 
+    if (!cameras.isEmpty()) {
+        QJsonArray camArr;
+        for (const CameraData &c : cameras) {
+            QJsonObject obj;
+            obj["image"] = c.image;
+            obj["intrinsics"] = matrixToJson(c.intrinsics);
+            obj["rotation"] = matrixToJson(c.rotation);
+            obj["translation"] = QJsonArray{c.translation.x(), c.translation.y(), c.translation.z()};
+            camArr.append(obj);
+        }
+        root["cameras"] = camArr;
+    }
+
     QJsonDocument doc(root);
-    QByteArray jsonData = doc.toJson();
-    return saveAms(path, jsonData, imagePaths);
+    return doc.toJson();
 }
 
-bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators)
+static bool sceneFromJson(const QByteArray &jsonData, QStringList &imagePaths,
+                          QList<LocatorData> &locators, QList<CameraData> *cameras,
+                          QString *calibrationProfile)
 {
-    QByteArray jsonData;
-    QList<LoadedImage> loadedImages;
-    if(!loadAms(path, jsonData, loadedImages))
-        return false;
     QJsonDocument doc = QJsonDocument::fromJson(jsonData);
     if (!doc.isObject())
         return false;
     QJsonObject root = doc.object();
+    if (calibrationProfile)
+        *calibrationProfile = root["calibration_profile"].toString();
     imagePaths.clear();
     for (const QJsonValue &v : root["images"].toArray())
         imagePaths << v.toString();
@@ -92,7 +132,52 @@ bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorDat
         }
         locators.append(l);
     }
+    if (cameras) {
+        cameras->clear();
+        for (const QJsonValue &cv : root["cameras"].toArray()) {
+            QJsonObject o = cv.toObject();
+            CameraData c;
+            c.image = o["image"].toInt(-1);
+            c.intrinsics = matrixFromJson(o["intrinsics"].toArray());
+            c.rotation = matrixFromJson(o["rotation"].toArray());
+            QJsonArray t = o["translation"].toArray();
+            if (t.size() == 3)
+                c.translation = Eigen::Vector3d(t[0].toDouble(), t[1].toDouble(), t[2].toDouble());
+            cameras->append(c);
+        }
+    }
     return true;
 }
 
+bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators,
+               const QString &calibrationProfile, const QList<CameraData> &cameras)
+{
+    return saveAms(path, sceneToJson(imagePaths, locators, cameras, calibrationProfile), imagePaths);
+}
+
+bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators,
+               const QList<CameraData> &cameras, const QList<LoadedImage> &images,
+               const QString &calibrationProfile)
+{
+    return saveAms(path, sceneToJson(imagePaths, locators, cameras, calibrationProfile), images);
+}
 
+bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators,
+                  QString *calibrationProfile, QList<CameraData> *cameras)
+{
+    QByteArray jsonData;
+    QList<LoadedImage> loadedImages;
+    if(!loadAms(path, jsonData, loadedImages))
+        return false;
+    return sceneFromJson(jsonData, imagePaths, locators, cameras, calibrationProfile);
+}
+
+bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators,
+                  QList<CameraData> &cameras, QList<LoadedImage> &images,
+                  QString *calibrationProfile)
+{
+    QByteArray jsonData;
+    if(!loadAms(path, jsonData, images))
+        return false;
+    return sceneFromJson(jsonData, imagePaths, locators, &cameras, calibrationProfile);
+}
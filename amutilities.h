@@ -7,6 +7,9 @@
 #include <QMap>
 #include <QPointF>
 #include <QList>
+#include "filesystem.h"
+
+#include <Eigen/Core>
 
 struct LocatorData {
     QString name;
@@ -14,10 +17,32 @@ struct LocatorData {
     float error = 0.0f;
 };
 
+// Calibrated camera of one image, kept in the "cameras" section of scene.json.
+struct CameraData {
+    int image = -1;
+    Eigen::Matrix3d intrinsics = Eigen::Matrix3d::Identity();
+    // Camera to world rotation and camera centre.
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+};
+
 QColor errorToColor(float error, float minErr = 0.0f, float maxErr = 10.0f);
-QVector<QImage> loadImages(const QStringList &paths);
+QVector<QImage> loadImages(const QStringList &paths, QVector<double> *decodeMs = nullptr);
 QStringList verifyPaths(const QStringList &paths);
-bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators);
-bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators);
+// The calibration profile is stored by name; an empty name is not written,
+// and neither is an empty camera list.
+bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators,
+               const QString &calibrationProfile = QString(),
+               const QList<CameraData> &cameras = {});
+bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators,
+                  QString *calibrationProfile = nullptr, QList<CameraData> *cameras = nullptr);
+// Batch variants: the images travel inside the archive, so a scene can be
+// loaded, calibrated and saved back without the original image files.
+bool loadSceneAms(const QString &path, QStringList &imagePaths, QList<LocatorData> &locators,
+                  QList<CameraData> &cameras, QList<LoadedImage> &images,
+                  QString *calibrationProfile = nullptr);
+bool saveScene(const QString &path, const QStringList &imagePaths, const QList<LocatorData> &locators,
+               const QList<CameraData> &cameras, const QList<LoadedImage> &images,
+               const QString &calibrationProfile = QString());
 
 #endif // AMUTILITIES_H
@@ -0,0 +1,377 @@
+// Runs CameraCalibrator on synthetic scenes and reports speed and accuracy
+// as JSON, so results can be compared between builds.
+//
+//   calibration_bench                      built-in scene suite
+//   calibration_bench --cameras 40 --points 200 --trajectory sphere
+//                     --noise 1 --outliers 0.05 --output result.json
+
+#include "camera_calibrator.h"
+#include "synthetic_scene.h"
+#include "triangulation.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QTextStream>
+#include <QtMath>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Peak resident memory of the process in KiB. It never goes down, so the
+// built-in suite runs its scenes from small to large.
+static qint64 peakMemoryKb() {
+#ifdef Q_OS_WIN
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return -1;
+  return static_cast<qint64>(counters.PeakWorkingSetSize / 1024);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+#ifdef Q_OS_MACOS
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct PoseError {
+  int count = 0;
+  double meanRotationDeg = 0;
+  double maxRotationDeg = 0;
+  // In ground truth units, after a similarity alignment.
+  double positionRmse = 0;
+  double meanFocalError = 0;
+};
+
+// The solution is only defined up to a similarity, so the estimated camera
+// centres are aligned to the ground truth with Umeyama's method first.
+static PoseError poseError(const CameraCalibrator &calibrator,
+                           const SyntheticScene &scene) {
+  PoseError error;
+  const QVector<int> &registered = calibrator.getRegisteredIndices();
+  const std::vector<CameraSolution> &cameras = calibrator.cameras();
+  if (registered.size() < 3)
+    return error;
+
+  const int n = registered.size();
+  Eigen::Matrix3Xd estimated(3, n);
+  Eigen::Matrix3Xd truth(3, n);
+  for (int k = 0; k < n; ++k) {
+    const int idx = registered[k];
+    estimated.col(k) = cameras[idx].center();
+    truth.col(k) = scene.centers[idx];
+  }
+  const Eigen::Matrix4d similarity = Eigen::umeyama(estimated, truth, true);
+  const Eigen::Matrix3d sR = similarity.topLeftCorner<3, 3>();
+  const Eigen::Matrix3d R = sR / sR.col(0).norm();
+  const Eigen::Vector3d shift = similarity.topRightCorner<3, 1>();
+
+  double squaredSum = 0;
+  for (int k = 0; k < n; ++k) {
+    const int idx = registered[k];
+    squaredSum += (sR * estimated.col(k) + shift - truth.col(k)).squaredNorm();
+
+    const Eigen::Matrix3d delta =
+        scene.rotations[idx].transpose() * R * cameras[idx].rotationMatrix();
+    const double cosine =
+        std::clamp((delta.trace() - 1.0) / 2.0, -1.0, 1.0);
+    const double degrees = std::acos(cosine) * 180.0 / M_PI;
+    error.meanRotationDeg += degrees;
+    error.maxRotationDeg = std::max(error.maxRotationDeg, degrees);
+    error.meanFocalError +=
+        std::abs(cameras[idx].intrinsics[0] - scene.focalLength) /
+        scene.focalLength;
+  }
+  error.count = n;
+  error.meanRotationDeg /= n;
+  error.positionRmse = std::sqrt(squaredSum / n);
+  error.meanFocalError /= n;
+  return error;
+}
+
+static QJsonObject sceneJson(const SyntheticSceneOptions &options,
+                             const SyntheticScene &scene) {
+  int observations = 0;
+  for (const QMap<int, QPointF> &clicks : scene.pointData)
+    observations += clicks.size();
+  QJsonObject json;
+  json["trajectory"] = trajectoryName(options.trajectory);
+  json["cameras"] = options.numCameras;
+  json["points"] = options.numPoints;
+  json["locators"] = scene.pointData.size();
+  json["observations"] = observations;
+  json["noise"] = options.noise;
+  json["outlierRate"] = options.outlierRate;
+  json["seed"] = static_cast<int>(options.seed);
+  return json;
+}
+
+static QJsonObject timingsJson(const CalibrationTimings &timings) {
+  QJsonObject json;
+  json["outlierRejection"] = timings.outlierRejection;
+  json["preparation"] = timings.preparation;
+  json["reconstruction"] = timings.reconstruction;
+  json["bundleAdjustment"] = timings.bundleAdjustment;
+  json["extraction"] = timings.extraction;
+  json["total"] = timings.total;
+  return json;
+}
+
+static QString solverName(CameraCalibrator::Solver solver) {
+  switch (solver) {
+  case CameraCalibrator::Solver::Direct:
+    return QStringLiteral("direct");
+  case CameraCalibrator::Solver::Incremental:
+    return QStringLiteral("incremental");
+  case CameraCalibrator::Solver::Partitioned:
+    return QStringLiteral("partitioned");
+  }
+  return QString();
+}
+
+static QJsonObject runCalibration(const SyntheticSceneOptions &options,
+                                  const SyntheticScene &scene,
+                                  CameraCalibrator::Solver solver,
+                                  CalibrationProfile profile,
+                                  int multiStartRuns, int partitionSize,
+                                  QTextStream &out) {
+  CameraCalibrator calibrator;
+  calibrator.setSolver(solver);
+  calibrator.setProfile(profile);
+  calibrator.setPartitionSize(partitionSize);
+  calibrator.setMultiStartRuns(multiStartRuns);
+  calibrator.setRejectOutliers(true);
+  calibrator.loadImageSizes(scene.imagePaths, scene.imageSizes);
+  calibrator.loadPointData(scene.pointData);
+  const bool ok = calibrator.calibrate();
+  const CalibrationTimings timings = calibrator.timings();
+  const double registeredFraction =
+      double(calibrator.getRegisteredIndices().size()) / options.numCameras;
+
+  QJsonObject json;
+  json["scene"] = sceneJson(options, scene);
+  json["solver"] = solverName(solver);
+  json["profile"] = calibrationProfileName(profile);
+  json["multiStartRuns"] = multiStartRuns;
+  json["partitionSize"] = partitionSize;
+  json["success"] = ok;
+  json["timingsMs"] = timingsJson(timings);
+  json["peakMemoryKb"] = peakMemoryKb();
+  json["registeredFraction"] = registeredFraction;
+
+  const PoseError error = poseError(calibrator, scene);
+  if (error.count > 0) {
+    QJsonObject pose;
+    pose["meanRotationDeg"] = error.meanRotationDeg;
+    pose["maxRotationDeg"] = error.maxRotationDeg;
+    pose["positionRmse"] = error.positionRmse;
+    pose["meanFocalError"] = error.meanFocalError;
+    json["poseError"] = pose;
+  }
+
+  QSet<QPair<int, int>> injected;
+  for (const LocatorObservation &o : scene.outliers)
+    injected.insert(qMakePair(o.locator, o.image));
+  const QVector<LocatorObservation> rejected = calibrator.outliers();
+  int correct = 0;
+  for (const LocatorObservation &o : rejected)
+    correct += injected.contains(qMakePair(o.locator, o.image)) ? 1 : 0;
+  QJsonObject outliers;
+  outliers["injected"] = scene.outliers.size();
+  outliers["rejected"] = rejected.size();
+  outliers["correct"] = correct;
+  json["outliers"] = outliers;
+
+  out << QStringLiteral("%1 %2x%3 %4: %5 ms, %6% registered")
+             .arg(trajectoryName(options.trajectory))
+             .arg(options.numCameras)
+             .arg(options.numPoints)
+             .arg(json["solver"].toString())
+             .arg(timings.total, 0, 'f', 1)
+             .arg(registeredFraction * 100.0, 0, 'f', 0);
+  if (error.count > 0)
+    out << QStringLiteral(", rot %1 deg, pos %2")
+               .arg(error.meanRotationDeg, 0, 'f', 3)
+               .arg(error.positionRmse, 0, 'g', 3);
+  out << Qt::endl;
+  return json;
+}
+
+// Triangulates every locator from the ground truth cameras, repeating until
+// enough time has passed for a stable rate.
+static QJsonObject runTriangulation(const SyntheticSceneOptions &options,
+                                    const SyntheticScene &scene,
+                                    QTextStream &out) {
+  static const qint64 kMinDurationNs = 200 * 1000 * 1000;
+  Eigen::Matrix3d K;
+  K << scene.focalLength, 0, options.width / 2.0, 0, scene.focalLength,
+      options.height / 2.0, 0, 0, 1;
+  ProjectionTable projections;
+  for (int i = 0; i < options.numCameras; ++i)
+    projections.set(i, makeProjectionMatrix(K, scene.rotations[i],
+                                            scene.centers[i]));
+
+  QElapsedTimer timer;
+  timer.start();
+  qint64 iterations = 0;
+  do {
+    triangulatePoints(scene.pointData, projections);
+    ++iterations;
+  } while (timer.nsecsElapsed() < kMinDurationNs);
+  const double seconds = timer.nsecsElapsed() / 1e9;
+  const double pointsPerSecond =
+      scene.pointData.size() * iterations / seconds;
+
+  QJsonObject json;
+  json["scene"] = sceneJson(options, scene);
+  json["iterations"] = iterations;
+  json["pointsPerSecond"] = pointsPerSecond;
+  out << QStringLiteral("triangulation %1 locators: %2 points/s")
+             .arg(scene.pointData.size())
+             .arg(pointsPerSecond, 0, 'f', 0)
+      << Qt::endl;
+  return json;
+}
+
+static QVector<SyntheticSceneOptions> builtinSuite() {
+  struct Entry {
+    SyntheticSceneOptions::Trajectory trajectory;
+    int cameras;
+    int points;
+    double outlierRate;
+  };
+  static const Entry kSuite[] = {
+      {SyntheticSceneOptions::Orbit, 10, 50, 0.0},
+      {SyntheticSceneOptions::Line, 20, 100, 0.0},
+      {SyntheticSceneOptions::Orbit, 30, 150, 0.05},
+      {SyntheticSceneOptions::Sphere, 60, 300, 0.0},
+      {SyntheticSceneOptions::Orbit, 120, 600, 0.02},
+  };
+  QVector<SyntheticSceneOptions> suite;
+  for (const Entry &entry : kSuite) {
+    SyntheticSceneOptions options;
+    options.trajectory = entry.trajectory;
+    options.numCameras = entry.cameras;
+    options.numPoints = entry.points;
+    options.outlierRate = entry.outlierRate;
+    suite.append(options);
+  }
+  return suite;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Calibrates synthetic scenes and reports timings and pose errors.");
+  parser.addHelpOption();
+  QCommandLineOption camerasOption("cameras", "Number of cameras.", "n");
+  QCommandLineOption pointsOption("points", "Number of 3D points.", "n", "100");
+  QCommandLineOption trajectoryOption(
+      "trajectory", "Camera path: orbit, line or sphere.", "name", "orbit");
+  QCommandLineOption noiseOption("noise", "Pixel noise sigma.", "px", "0.5");
+  QCommandLineOption outliersOption(
+      "outliers", "Fraction of clicks replaced by random pixels.", "rate",
+      "0");
+  QCommandLineOption seedOption("seed", "Random seed.", "n", "1");
+  QCommandLineOption solverOption(
+      "solver", "direct, incremental, partitioned, both or all.", "name",
+      "both");
+  QCommandLineOption runsOption("runs", "Multi-start mapper runs.", "n", "1");
+  QCommandLineOption partitionOption(
+      "partition-size", "Largest cluster of the partitioned solver.", "images",
+      "50");
+  QCommandLineOption profileOption(
+      "profile", "interactive-fast, balanced or final-accurate.", "name",
+      "balanced");
+  QCommandLineOption repeatOption("repeat", "Runs per scene and solver.", "n",
+                                  "1");
+  QCommandLineOption outputOption("output", "Write the JSON report here.",
+                                  "file");
+  parser.addOptions({camerasOption, pointsOption, trajectoryOption,
+                     noiseOption, outliersOption, seedOption, solverOption,
+                     runsOption, partitionOption, profileOption, repeatOption,
+                     outputOption});
+  parser.process(app);
+
+  // A scene given on the command line replaces the built-in suite.
+  QVector<SyntheticSceneOptions> scenes;
+  if (parser.isSet(camerasOption)) {
+    SyntheticSceneOptions options;
+    options.numCameras = parser.value(camerasOption).toInt();
+    options.numPoints = parser.value(pointsOption).toInt();
+    options.noise = parser.value(noiseOption).toDouble();
+    options.outlierRate = parser.value(outliersOption).toDouble();
+    options.seed = parser.value(seedOption).toUInt();
+    if (!parseTrajectory(parser.value(trajectoryOption), &options.trajectory))
+      parser.showHelp(1);
+    scenes.append(options);
+  } else {
+    scenes = builtinSuite();
+  }
+
+  QVector<CameraCalibrator::Solver> solvers;
+  const QString solverList = parser.value(solverOption);
+  const bool all = solverList == "all";
+  if (solverList == "direct" || solverList == "both" || all)
+    solvers.append(CameraCalibrator::Solver::Direct);
+  if (solverList == "incremental" || solverList == "both" || all)
+    solvers.append(CameraCalibrator::Solver::Incremental);
+  if (solverList == "partitioned" || all)
+    solvers.append(CameraCalibrator::Solver::Partitioned);
+  if (solvers.isEmpty())
+    parser.showHelp(1);
+  const int multiStartRuns = std::max(1, parser.value(runsOption).toInt());
+  const int partitionSize = parser.value(partitionOption).toInt();
+  CalibrationProfile profile = CalibrationProfile::Balanced;
+  if (!parseCalibrationProfile(parser.value(profileOption), &profile))
+    parser.showHelp(1);
+  const int repeat = std::max(1, parser.value(repeatOption).toInt());
+
+  QTextStream out(stdout);
+  QJsonArray runs;
+  QJsonArray triangulation;
+  for (const SyntheticSceneOptions &options : scenes) {
+    const SyntheticScene scene = generateSyntheticScene(options);
+    triangulation.append(runTriangulation(options, scene, out));
+    for (CameraCalibrator::Solver solver : solvers)
+      for (int r = 0; r < repeat; ++r)
+        runs.append(runCalibration(options, scene, solver, profile,
+                                   multiStartRuns, partitionSize, out));
+  }
+
+  QJsonObject report;
+  report["runs"] = runs;
+  report["triangulation"] = triangulation;
+  const QByteArray json = QJsonDocument(report).toJson();
+  if (parser.isSet(outputOption)) {
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly)) {
+      out << "Cannot write " << file.fileName() << Qt::endl;
+      return 1;
+    }
+    file.write(json);
+  } else {
+    out << json;
+  }
+  return 0;
+}
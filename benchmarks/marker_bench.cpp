@@ -0,0 +1,185 @@
+// Times MarkerItem edits and paints against the number of locators on an
+// image and reports them as JSON, so results can be compared between builds.
+//
+//   marker_bench                           1k, 10k and 100k markers
+//   marker_bench --counts 5000,50000 --frames 50 --output result.json
+//
+// Runs on the offscreen platform unless QT_QPA_PLATFORM says otherwise.
+
+#include "markeritem.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QTextStream>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const QSize kImageSize(6000, 4000);
+static const QSize kViewportSize(1920, 1080);
+
+static QString markerName(int i) { return QStringLiteral("loc_%1").arg(i); }
+
+static QList<ViewerMarker> randomMarkers(int count, std::mt19937 &rng) {
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  QList<ViewerMarker> markers;
+  markers.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    ViewerMarker m;
+    m.x = unit(rng);
+    m.y = unit(rng);
+    m.name = markerName(i);
+    m.error = 10.0f * unit(rng);
+    markers.append(m);
+  }
+  return markers;
+}
+
+static double perOpUs(const QElapsedTimer &timer, int ops) {
+  return ops > 0 ? timer.nsecsElapsed() / 1e3 / ops : 0.0;
+}
+
+// Mean time of one paint() into a viewport-sized image, with the item
+// scaled by deviceScale and the viewport centred on the image.
+static double paintMs(MarkerItem &item, double deviceScale, int frames) {
+  QImage target(kViewportSize, QImage::Format_ARGB32_Premultiplied);
+  QTransform world;
+  world.translate(kViewportSize.width() / 2.0, kViewportSize.height() / 2.0);
+  world.scale(deviceScale, deviceScale);
+  world.translate(-kImageSize.width() / 2.0, -kImageSize.height() / 2.0);
+
+  QStyleOptionGraphicsItem option;
+  option.exposedRect =
+      world.inverted().mapRect(QRectF(QPointF(0, 0), QSizeF(kViewportSize)));
+  QElapsedTimer timer;
+  qint64 total = 0;
+  // An untimed first frame prepares the label glyph runs.
+  for (int f = -1; f < frames; ++f) {
+    target.fill(Qt::white);
+    QPainter painter(&target);
+    painter.setWorldTransform(world);
+    timer.start();
+    item.paint(&painter, &option);
+    if (f >= 0)
+      total += timer.nsecsElapsed();
+  }
+  return frames > 0 ? total / 1e6 / frames : 0.0;
+}
+
+static QJsonObject runCount(int count, int frames, QTextStream &out) {
+  std::mt19937 rng(static_cast<unsigned>(count));
+  const QList<ViewerMarker> markers = randomMarkers(count, rng);
+  QJsonObject json;
+  json["markers"] = count;
+
+  MarkerItem item;
+  item.setImageSize(kImageSize);
+  QElapsedTimer timer;
+  timer.start();
+  item.setMarkers(markers);
+  json["setMarkersMs"] = timer.nsecsElapsed() / 1e6;
+
+  MarkerItem incremental;
+  incremental.setImageSize(kImageSize);
+  timer.start();
+  for (const ViewerMarker &m : markers)
+    incremental.updateMarker(m);
+  json["addUs"] = perOpUs(timer, count);
+
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  QList<ViewerMarker> moved = markers;
+  for (ViewerMarker &m : moved) {
+    m.x = unit(rng);
+    m.y = unit(rng);
+  }
+  timer.start();
+  for (const ViewerMarker &m : moved)
+    incremental.updateMarker(m);
+  json["moveUs"] = perOpUs(timer, count);
+
+  const double fitScale =
+      std::min(double(kViewportSize.width()) / kImageSize.width(),
+               double(kViewportSize.height()) / kImageSize.height());
+  json["paintFitMs"] = paintMs(item, fitScale, frames);
+  json["paintOneToOneMs"] = paintMs(item, 1.0, frames);
+
+  std::vector<int> order(count);
+  for (int i = 0; i < count; ++i)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  timer.start();
+  for (int i : order)
+    incremental.removeMarker(markerName(i));
+  json["removeUs"] = perOpUs(timer, count);
+
+  out << QStringLiteral("%1 markers: set %2 ms, add %3 us, move %4 us, "
+                        "remove %5 us, paint fit %6 ms, paint 1:1 %7 ms")
+             .arg(count)
+             .arg(json["setMarkersMs"].toDouble(), 0, 'f', 2)
+             .arg(json["addUs"].toDouble(), 0, 'f', 2)
+             .arg(json["moveUs"].toDouble(), 0, 'f', 2)
+             .arg(json["removeUs"].toDouble(), 0, 'f', 2)
+             .arg(json["paintFitMs"].toDouble(), 0, 'f', 2)
+             .arg(json["paintOneToOneMs"].toDouble(), 0, 'f', 2)
+      << Qt::endl;
+  return json;
+}
+
+int main(int argc, char *argv[]) {
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Times marker edits and paints for growing locator counts.");
+  parser.addHelpOption();
+  QCommandLineOption countsOption("counts", "Comma separated marker counts.",
+                                  "list", "1000,10000,100000");
+  QCommandLineOption framesOption("frames", "Paints timed per view.", "n",
+                                  "20");
+  QCommandLineOption outputOption("output", "Write the JSON report here.",
+                                  "file");
+  parser.addOptions({countsOption, framesOption, outputOption});
+  parser.process(app);
+
+  QVector<int> counts;
+  for (const QString &value : parser.value(countsOption).split(',')) {
+    bool ok = false;
+    const int count = value.trimmed().toInt(&ok);
+    if (!ok || count <= 0)
+      parser.showHelp(1);
+    counts.append(count);
+  }
+  const int frames = std::max(1, parser.value(framesOption).toInt());
+
+  QTextStream out(stderr);
+  QJsonArray runs;
+  for (int count : counts)
+    runs.append(runCount(count, frames, out));
+
+  QJsonObject report;
+  report["imageWidth"] = kImageSize.width();
+  report["imageHeight"] = kImageSize.height();
+  report["runs"] = runs;
+  const QByteArray json = QJsonDocument(report).toJson();
+  if (parser.isSet(outputOption)) {
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly)) {
+      out << "Cannot write " << file.fileName() << Qt::endl;
+      return 1;
+    }
+    file.write(json);
+  } else {
+    QTextStream(stdout) << json;
+  }
+  return 0;
+}
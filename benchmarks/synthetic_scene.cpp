@@ -0,0 +1,139 @@
+#include "synthetic_scene.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+static const double kCameraDistance = 4.0;
+
+// Camera to world rotation of a camera at center looking at target, with
+// the image x axis to the right and y pointing down (world z is up).
+static Eigen::Matrix3d lookAt(const Eigen::Vector3d &center,
+                              const Eigen::Vector3d &target) {
+  const Eigen::Vector3d z = (target - center).normalized();
+  const Eigen::Vector3d x = z.cross(Eigen::Vector3d::UnitZ()).normalized();
+  const Eigen::Vector3d y = z.cross(x);
+  Eigen::Matrix3d Rwc;
+  Rwc.col(0) = x;
+  Rwc.col(1) = y;
+  Rwc.col(2) = z;
+  return Rwc;
+}
+
+static void placeCameras(const SyntheticSceneOptions &options,
+                         std::mt19937 &rng, SyntheticScene *scene) {
+  const int n = options.numCameras;
+  std::uniform_real_distribution<double> unit(-1.0, 1.0);
+  for (int i = 0; i < n; ++i) {
+    Eigen::Vector3d center;
+    Eigen::Vector3d target = Eigen::Vector3d::Zero();
+    switch (options.trajectory) {
+    case SyntheticSceneOptions::Orbit: {
+      const double angle = 2.0 * M_PI * i / n;
+      center = Eigen::Vector3d(kCameraDistance * std::cos(angle),
+                               kCameraDistance * std::sin(angle), 1.0);
+      break;
+    }
+    case SyntheticSceneOptions::Line: {
+      const double s = n > 1 ? double(i) / (n - 1) : 0.5;
+      center = Eigen::Vector3d(-3.0 + 6.0 * s, -kCameraDistance, 0.5);
+      // Turn slightly towards the middle of the move.
+      target = Eigen::Vector3d(0.5 * center.x(), 0, 0);
+      break;
+    }
+    case SyntheticSceneOptions::Sphere: {
+      Eigen::Vector3d dir;
+      do {
+        dir = Eigen::Vector3d(unit(rng), unit(rng), unit(rng));
+      } while (dir.norm() < 0.1 || dir.norm() > 1.0 ||
+               std::abs(dir.normalized().z()) > 0.9);
+      center = kCameraDistance * dir.normalized();
+      target = 0.2 * Eigen::Vector3d(unit(rng), unit(rng), unit(rng));
+      break;
+    }
+    }
+    scene->centers.push_back(center);
+    scene->rotations.push_back(lookAt(center, target));
+  }
+}
+
+SyntheticScene generateSyntheticScene(const SyntheticSceneOptions &options) {
+  SyntheticScene scene;
+  scene.focalLength = options.focalLength;
+  std::mt19937 rng(options.seed);
+  placeCameras(options, rng, &scene);
+
+  std::uniform_real_distribution<double> unit(-1.0, 1.0);
+  for (int p = 0; p < options.numPoints; ++p)
+    scene.points.emplace_back(unit(rng), unit(rng), unit(rng));
+
+  const QSize size(options.width, options.height);
+  for (int i = 0; i < options.numCameras; ++i) {
+    scene.imagePaths.append(
+        QStringLiteral("synthetic_%1.jpg").arg(i, 4, 10, QLatin1Char('0')));
+    scene.imageSizes.append(size);
+  }
+
+  std::normal_distribution<double> noise(0.0, std::max(0.0, options.noise));
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  std::uniform_real_distribution<double> randomX(0.0, options.width);
+  std::uniform_real_distribution<double> randomY(0.0, options.height);
+  const double cx = options.width / 2.0;
+  const double cy = options.height / 2.0;
+  for (int p = 0; p < options.numPoints; ++p) {
+    QMap<int, QPointF> clicks;
+    QVector<LocatorObservation> pointOutliers;
+    for (int i = 0; i < options.numCameras; ++i) {
+      const Eigen::Vector3d X =
+          scene.rotations[i].transpose() * (scene.points[p] - scene.centers[i]);
+      if (X.z() <= 0.1)
+        continue;
+      double x = options.focalLength * X.x() / X.z() + cx;
+      double y = options.focalLength * X.y() / X.z() + cy;
+      if (x < 0 || y < 0 || x >= options.width || y >= options.height)
+        continue;
+      if (chance(rng) < options.outlierRate) {
+        x = randomX(rng);
+        y = randomY(rng);
+        pointOutliers.append(LocatorObservation{p, i});
+      } else if (options.noise > 0) {
+        x += noise(rng);
+        y += noise(rng);
+      }
+      clicks.insert(i, QPointF(x, y));
+    }
+    // A locator clicked in a single image carries no information.
+    if (clicks.size() < 2)
+      continue;
+    scene.pointData.insert(p, clicks);
+    scene.outliers += pointOutliers;
+  }
+  return scene;
+}
+
+QString trajectoryName(SyntheticSceneOptions::Trajectory trajectory) {
+  switch (trajectory) {
+  case SyntheticSceneOptions::Orbit:
+    return QStringLiteral("orbit");
+  case SyntheticSceneOptions::Line:
+    return QStringLiteral("line");
+  case SyntheticSceneOptions::Sphere:
+    return QStringLiteral("sphere");
+  }
+  return QString();
+}
+
+bool parseTrajectory(const QString &name,
+                     SyntheticSceneOptions::Trajectory *trajectory) {
+  for (SyntheticSceneOptions::Trajectory t :
+       {SyntheticSceneOptions::Orbit, SyntheticSceneOptions::Line,
+        SyntheticSceneOptions::Sphere}) {
+    if (name.compare(trajectoryName(t), Qt::CaseInsensitive) == 0) {
+      *trajectory = t;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,56 @@
+#ifndef SYNTHETIC_SCENE_H
+#define SYNTHETIC_SCENE_H
+
+#include "outlier_detection.h"
+
+#include <QMap>
+#include <QPointF>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <Eigen/Core>
+
+#include <vector>
+
+struct SyntheticSceneOptions {
+  // Orbit: a ring around the points looking at the centre. Line: a dolly
+  // move in front of the points. Sphere: random positions on a sphere
+  // around the points.
+  enum Trajectory { Orbit, Line, Sphere };
+
+  int numCameras = 20;
+  int numPoints = 100;
+  Trajectory trajectory = Orbit;
+  // Standard deviation of the pixel noise added to every click.
+  double noise = 0.5;
+  // Fraction of clicks moved to a uniformly random pixel.
+  double outlierRate = 0.0;
+  int width = 1920;
+  int height = 1080;
+  double focalLength = 1600.0;
+  unsigned seed = 1;
+};
+
+// Points are spread uniformly in [-1, 1]^3 and cameras sit about four
+// units away. Clicks are in pixels, keyed like CameraCalibrator input.
+struct SyntheticScene {
+  QStringList imagePaths;
+  QVector<QSize> imageSizes;
+  QMap<int, QMap<int, QPointF>> pointData;
+  QVector<LocatorObservation> outliers;
+  // Ground truth, camera to world like CameraCalibrator results.
+  std::vector<Eigen::Matrix3d> rotations;
+  std::vector<Eigen::Vector3d> centers;
+  std::vector<Eigen::Vector3d> points;
+  double focalLength = 0;
+};
+
+SyntheticScene generateSyntheticScene(const SyntheticSceneOptions &options);
+
+QString trajectoryName(SyntheticSceneOptions::Trajectory trajectory);
+bool parseTrajectory(const QString &name,
+                     SyntheticSceneOptions::Trajectory *trajectory);
+
+#endif // SYNTHETIC_SCENE_H
@@ -1,111 +1,497 @@
 #include "camera_calibrator.h"
+#include "parallel_for.h"
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QHash>
 #include <QImage>
+#include <QImageReader>
+#include <QSet>
+#include <QTemporaryDir>
 #include <QtMath>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <Eigen/SVD>
 
 #include <colmap/controllers/incremental_pipeline.h>
+#include <colmap/estimators/bundle_adjustment.h>
+#include <colmap/estimators/homography_matrix.h>
+#include <colmap/estimators/pose.h>
+#include <colmap/estimators/two_view_geometry.h>
 #include <colmap/scene/camera.h>
 #include <colmap/scene/database.h>
+#include <colmap/scene/database_cache.h>
 #include <colmap/scene/image.h>
-#include <colmap/scene/reconstruction_manager.h>
+#include <colmap/scene/reconstruction.h>
+#include <colmap/scene/scene_clustering.h>
+#include <colmap/sfm/incremental_mapper.h>
+#include <colmap/util/math.h>
+#include <colmap/optim/loransac.h>
+#include <colmap/util/random.h>
+
+#include <ceres/iteration_callback.h>
 
 using namespace colmap;
 
+Eigen::Matrix3d CameraSolution::intrinsicMatrix() const {
+  Eigen::Matrix3d K;
+  K << intrinsics[0], 0, intrinsics[1], 0, intrinsics[0], intrinsics[2], 0, 0,
+      1;
+  return K;
+}
+
+Eigen::Matrix3d CameraSolution::rotationMatrix() const {
+  return Eigen::Quaterniond(rotation[0], rotation[1], rotation[2], rotation[3])
+      .toRotationMatrix();
+}
+
+void CameraCalibrator::setWorkspaceRoot(const QString &root) {
+  m_workspaceRoot = root;
+}
+
+void CameraCalibrator::setKeepWorkspace(bool keep) { m_keepWorkspace = keep; }
+
+// Reads the image dimensions from the file header only. Falls back to a full
+// decode for formats whose reader cannot report a size up front.
+static QSize readImageSize(const QString &path) {
+  QImageReader reader(path);
+  QSize size = reader.size();
+  if (!size.isValid())
+    return QImage(path).size();
+  // Match what QImage(path) would return for rotated images.
+  if (reader.autoTransform() &&
+      reader.transformation().testFlag(QImageIOHandler::TransformationRotate90))
+    size.transpose();
+  return size;
+}
+
+// Every database and model uses image id = project index + 1, so results
+// map back to indices without any name lookups.
+static image_t imageIdOf(int index) { return static_cast<image_t>(index + 1); }
+
+static int indexOfImage(image_t id, int numImages) {
+  const int idx = static_cast<int>(id) - 1;
+  return idx >= 0 && idx < numImages ? idx : -1;
+}
+
 bool CameraCalibrator::loadImages(const QStringList &paths) {
+  QVector<QSize> sizes;
+  QVector<ExifInfo> exif;
+  sizes.reserve(paths.size());
+  exif.reserve(paths.size());
+  for (const QString &path : paths) {
+    sizes.append(readImageSize(path));
+    exif.append(cachedExif(path));
+  }
+  return loadImageSizes(paths, sizes, exif);
+}
+
+bool CameraCalibrator::loadImageSizes(const QStringList &paths,
+                                      const QVector<QSize> &sizes,
+                                      const QVector<ExifInfo> &exif) {
+  if (sizes.size() != paths.size())
+    return false;
   m_imagePaths = paths;
+  m_imageExif = exif;
+  m_imageExif.resize(paths.size());
   m_imageShapes.clear();
-  for (const QString &p : paths) {
-    QImage img(p);
-    m_imageShapes.append(qMakePair(img.width(), img.height()));
+  m_imageNames.clear();
+  // COLMAP image names must be unique. Images sharing a basename with an
+  // earlier one get a numeric prefix.
+  QSet<QString> usedNames;
+  for (int i = 0; i < paths.size(); ++i) {
+    m_imageShapes.append(qMakePair(sizes[i].width(), sizes[i].height()));
+    const QString base = QFileInfo(paths[i]).fileName();
+    QString name = base;
+    for (int n = 2; usedNames.contains(name); ++n)
+      name = QStringLiteral("%1_%2").arg(n).arg(base);
+    usedNames.insert(name);
+    m_imageNames.append(name);
   }
   return !m_imagePaths.isEmpty();
 }
 
+void CameraCalibrator::setCameraGroups(const QVector<int> &groups) {
+  m_userCameraGroups = groups;
+}
+
+QVector<int> CameraCalibrator::cameraGroups() const {
+  // User groups are numbered first, in order of appearance; the remaining
+  // images are grouped by size since a different size means a different
+  // sensor crop or body anyway. EXIF splits them further by body, lens and
+  // zoom setting when it is present.
+  QVector<int> groups(m_imagePaths.size(), -1);
+  QHash<int, int> userGroups;
+  QHash<QString, int> sizeGroups;
+  int next = 0;
+  for (int i = 0; i < groups.size(); ++i) {
+    const int user = i < m_userCameraGroups.size() ? m_userCameraGroups[i] : -1;
+    if (user < 0)
+      continue;
+    auto it = userGroups.constFind(user);
+    if (it == userGroups.constEnd())
+      it = userGroups.insert(user, next++);
+    groups[i] = it.value();
+  }
+  for (int i = 0; i < groups.size(); ++i) {
+    if (groups[i] >= 0)
+      continue;
+    const QString key = QStringLiteral("%1x%2|%3")
+                            .arg(m_imageShapes[i].first)
+                            .arg(m_imageShapes[i].second)
+                            .arg(m_imageExif.value(i).cameraKey());
+    auto it = sizeGroups.constFind(key);
+    if (it == sizeGroups.constEnd())
+      it = sizeGroups.insert(key, next++);
+    groups[i] = it.value();
+  }
+  return groups;
+}
+
 bool CameraCalibrator::loadPointData(
     const QMap<int, QMap<int, QPointF>> &data) {
   m_pointData = data;
   return !m_pointData.isEmpty();
 }
 
-bool CameraCalibrator::populateDatabase(const QString &dbPath) {
+namespace {
+
+// Locator observations laid out as COLMAP keypoints. Keypoints are numbered
+// per image in locator order; each track lists the (image, keypoint) pairs
+// that observe one locator in at least two images.
+struct TrackTable {
+  std::vector<FeatureKeypoints> keypoints;
+  // Track of every keypoint, or -1 for locators seen in a single image.
+  std::vector<std::vector<int>> keypointTracks;
+  std::vector<int> trackSetIds;
+  std::vector<std::vector<std::pair<int, point2D_t>>> tracks;
+};
+
+} // namespace
+
+// Result of the last successful run, kept so refine() can start from it.
+struct CameraCalibrator::Solution {
+  std::shared_ptr<const Reconstruction> reconstruction;
+  QStringList imagePaths;
+  QMap<int, QMap<int, QPointF>> pointData;
+  std::unordered_map<int, Eigen::Vector3d> setPoints;
+};
+
+static TrackTable
+buildTrackTable(const QMap<int, QMap<int, QPointF>> &pointData, int numImages,
+                QVector<QVector<int>> *keypointSetIds) {
+  TrackTable table;
+  table.keypoints.resize(numImages);
+  table.keypointTracks.resize(numImages);
+  table.tracks.reserve(pointData.size());
+  *keypointSetIds = QVector<QVector<int>>(numImages);
+  for (auto it = pointData.cbegin(); it != pointData.cend(); ++it) {
+    std::vector<std::pair<int, point2D_t>> track;
+    for (auto obs = it.value().cbegin(); obs != it.value().cend(); ++obs) {
+      const int i = obs.key();
+      if (i < 0 || i >= numImages)
+        continue;
+      track.emplace_back(i, static_cast<point2D_t>(table.keypoints[i].size()));
+      table.keypoints[i].emplace_back(obs.value().x(), obs.value().y(), 1.0f,
+                                      0.0f);
+      table.keypointTracks[i].push_back(-1);
+      (*keypointSetIds)[i].append(it.key());
+    }
+    if (track.size() >= 2) {
+      for (const auto &obs : track)
+        table.keypointTracks[obs.first][obs.second] =
+            static_cast<int>(table.tracks.size());
+      table.trackSetIds.push_back(it.key());
+      table.tracks.push_back(std::move(track));
+    }
+  }
+  return table;
+}
+
+// Matches between every pair of images that share a locator, keyed by
+// (first << 32 | second) with first < second. Only co-visible pairs appear,
+// so the cost follows the co-visibility graph instead of all N^2 pairs.
+static std::unordered_map<uint64_t, FeatureMatches>
+buildPairMatches(const TrackTable &table) {
+  std::unordered_map<uint64_t, FeatureMatches> pairMatches;
+  for (const auto &track : table.tracks) {
+    for (size_t a = 0; a < track.size(); ++a) {
+      for (size_t b = a + 1; b < track.size(); ++b) {
+        const auto &obsA = track[a].first < track[b].first ? track[a] : track[b];
+        const auto &obsB = track[a].first < track[b].first ? track[b] : track[a];
+        const uint64_t key =
+            (static_cast<uint64_t>(obsA.first) << 32) | obsB.first;
+        pairMatches[key].emplace_back(obsA.second, obsB.second);
+      }
+    }
+  }
+  return pairMatches;
+}
+
+// Keys of the pairs with at least minMatches matches, most matches first.
+static std::vector<uint64_t>
+pairsByMatchCount(const std::unordered_map<uint64_t, FeatureMatches> &pairMatches,
+                  size_t minMatches) {
+  std::vector<std::pair<size_t, uint64_t>> ranked;
+  for (const auto &entry : pairMatches) {
+    if (entry.second.size() >= minMatches)
+      ranked.emplace_back(entry.second.size(), entry.first);
+  }
+  std::sort(ranked.begin(), ranked.end(),
+            std::greater<std::pair<size_t, uint64_t>>());
+  std::vector<uint64_t> keys;
+  keys.reserve(ranked.size());
+  for (const auto &entry : ranked)
+    keys.push_back(entry.second);
+  return keys;
+}
+
+static std::vector<Eigen::Vector2d>
+keypointPositions(const FeatureKeypoints &keypoints) {
+  std::vector<Eigen::Vector2d> points;
+  points.reserve(keypoints.size());
+  for (const FeatureKeypoint &kp : keypoints)
+    points.emplace_back(kp.x, kp.y);
+  return points;
+}
+
+// Simple pinhole camera. The focal length comes from EXIF when known and
+// is then marked as a prior; otherwise it is the usual guess of 1.2 times
+// the larger image side.
+static Camera makeCamera(const QPair<int, int> &shape, const ExifInfo &exif) {
+  size_t width = static_cast<size_t>(shape.first);
+  size_t height = static_cast<size_t>(shape.second);
+  const double exifFocal = exif.focalLengthPixels(shape.first, shape.second);
+  double f = exifFocal > 0 ? exifFocal : 1.2 * qMax(width, height);
+  double cx = width / 2.0;
+  double cy = height / 2.0;
+  Camera cam;
+  cam.camera_id = kInvalidCameraId;
+  cam.model_id = CameraModelId::kSimplePinhole;
+  cam.width = width;
+  cam.height = height;
+  cam.params = {f, cx, cy};
+  cam.has_prior_focal_length = exifFocal > 0;
+  return cam;
+}
+
+// Camera of every image: images of one group share the camera of the
+// group's first image.
+static std::vector<Camera> groupCameras(const QVector<int> &groups,
+                                        const QVector<QPair<int, int>> &shapes,
+                                        const QVector<ExifInfo> &exif) {
+  std::vector<Camera> cameras(groups.size());
+  QHash<int, int> firstOfGroup;
+  for (int i = 0; i < groups.size(); ++i) {
+    const int first = firstOfGroup.value(groups[i], i);
+    firstOfGroup.insert(groups[i], first);
+    cameras[i] = makeCamera(shapes[first], exif.value(first));
+  }
+  return cameras;
+}
+
+// Fewest matches for the full E, F and H estimate. Smaller pairs with a
+// focal length prior on both cameras still get the essential matrix from
+// kMinEssentialMatches on, and otherwise a homography from
+// kMinHomographyMatches on, two more than its minimal sample.
+static const size_t kMinEpipolarMatches = 8;
+static const size_t kMinEssentialMatches = 5;
+static const size_t kMinHomographyMatches = 6;
+
+// Largest singular value spread of K2^-1 H K1 still taken as a pure rotation.
+static const double kMaxPanoramicSpread = 1.15;
+
+namespace {
+
+struct PairGeometry {
+  uint64_t key = 0;
+  FeatureMatches matches;
+  TwoViewGeometry geometry;
+};
+
+} // namespace
+
+// A pair too small to verify: all of its matches, as the mapper always saw
+// small pairs.
+static TwoViewGeometry unverifiedGeometry(const FeatureMatches &matches) {
+  TwoViewGeometry geometry;
+  geometry.config = TwoViewGeometry::CALIBRATED;
+  geometry.inlier_matches = matches;
+  return geometry;
+}
+
+// Checks a small pair without a focal length prior against a homography.
+// It is only accepted when it explains every match, so no match is lost to
+// a consensus of a few arbitrary points. With focal length priors a
+// rotation about the camera centre makes K2^-1 H K1 a scaled rotation,
+// which tells panoramic pairs from planar ones; without them the pair is
+// taken as planar. Pairs the homography does not explain stay unverified.
+static TwoViewGeometry
+estimatePairHomography(const Camera &camera1,
+                       const std::vector<Eigen::Vector2d> &points1,
+                       const Camera &camera2,
+                       const std::vector<Eigen::Vector2d> &points2,
+                       const FeatureMatches &matches, double maxError) {
+  if (matches.size() < kMinHomographyMatches)
+    return unverifiedGeometry(matches);
+
+  std::vector<Eigen::Vector2d> matched1, matched2;
+  matched1.reserve(matches.size());
+  matched2.reserve(matches.size());
+  for (const FeatureMatch &match : matches) {
+    matched1.push_back(points1[match.point2D_idx1]);
+    matched2.push_back(points2[match.point2D_idx2]);
+  }
+  RANSACOptions options;
+  options.max_error = maxError;
+  LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> ransac(
+      options);
+  const auto report = ransac.Estimate(matched1, matched2);
+  if (!report.success || report.support.num_inliers < matches.size())
+    return unverifiedGeometry(matches);
+
+  TwoViewGeometry geometry;
+  geometry.H = report.model;
+  geometry.inlier_matches = matches;
+  geometry.config = TwoViewGeometry::PLANAR;
+  if (camera1.has_prior_focal_length && camera2.has_prior_focal_length) {
+    const Eigen::Matrix3d rotation = camera2.CalibrationMatrix().inverse() *
+                                     report.model *
+                                     camera1.CalibrationMatrix();
+    const Eigen::Vector3d singular =
+        Eigen::JacobiSVD<Eigen::Matrix3d>(rotation).singularValues();
+    if (singular(2) > 0 && singular(0) < kMaxPanoramicSpread * singular(2))
+      geometry.config = TwoViewGeometry::PANORAMIC;
+  }
+  return geometry;
+}
+
+// Verifies every co-visible pair in parallel. With a focal length prior the
+// essential matrix is estimated, otherwise the fundamental matrix and a
+// homography, which also tells planar and panoramic pairs apart. Pairs that
+// fail the estimate come back degenerate without inliers, so the mapper
+// neither starts from nor relies on them. Pairs below kMinEpipolarMatches
+// are handled more carefully: they get the essential matrix when both
+// cameras have a prior and a full-support homography otherwise, and keep
+// all of their matches when neither can verify them.
+static std::vector<PairGeometry>
+estimatePairGeometries(const TrackTable &table,
+                       const std::vector<Camera> &cameras, double maxError,
+                       int numThreads) {
+  std::vector<PairGeometry> pairs;
+  for (auto &entry : buildPairMatches(table)) {
+    PairGeometry pair;
+    pair.key = entry.first;
+    pair.matches = std::move(entry.second);
+    pairs.push_back(std::move(pair));
+  }
+  std::sort(pairs.begin(), pairs.end(),
+            [](const PairGeometry &a, const PairGeometry &b) {
+              return a.key < b.key;
+            });
+
+  std::vector<std::vector<Eigen::Vector2d>> points(table.keypoints.size());
+  for (size_t i = 0; i < table.keypoints.size(); ++i)
+    points[i] = keypointPositions(table.keypoints[i]);
+
+  TwoViewGeometryOptions options;
+  options.min_num_inliers = kMinEssentialMatches;
+  options.ransac_options.max_error = maxError;
+  parallelFor(static_cast<int>(pairs.size()), [&](int p) {
+    PairGeometry &pair = pairs[p];
+    const size_t i1 = pair.key >> 32;
+    const size_t i2 = pair.key & 0xFFFFFFFFu;
+    const size_t numMatches = pair.matches.size();
+    if (numMatches >= kMinEpipolarMatches) {
+      pair.geometry = EstimateTwoViewGeometry(cameras[i1], points[i1],
+                                              cameras[i2], points[i2],
+                                              pair.matches, options);
+      return;
+    }
+    const bool calibrated = cameras[i1].has_prior_focal_length &&
+                            cameras[i2].has_prior_focal_length;
+    if (!calibrated) {
+      pair.geometry =
+          estimatePairHomography(cameras[i1], points[i1], cameras[i2],
+                                 points[i2], pair.matches, maxError);
+      return;
+    }
+    if (numMatches >= kMinEssentialMatches) {
+      pair.geometry = EstimateCalibratedTwoViewGeometry(
+          cameras[i1], points[i1], cameras[i2], points[i2], pair.matches,
+          options);
+      if (pair.geometry.config != TwoViewGeometry::DEGENERATE &&
+          pair.geometry.config != TwoViewGeometry::UNDEFINED &&
+          pair.geometry.inlier_matches.size() >= kMinEssentialMatches)
+        return;
+    }
+    pair.geometry = unverifiedGeometry(pair.matches);
+  }, 16, numThreads);
+  return pairs;
+}
+
+// Pair keys with at least minInliers verified matches, most inliers first.
+static std::vector<uint64_t>
+pairsByInlierCount(const std::vector<PairGeometry> &pairs, size_t minInliers) {
+  std::unordered_map<uint64_t, FeatureMatches> inliers;
+  for (const PairGeometry &pair : pairs)
+    inliers.emplace(pair.key, pair.geometry.inlier_matches);
+  return pairsByMatchCount(inliers, minInliers);
+}
+
+static bool populateDatabase(Database &db, const TrackTable &table,
+                             const std::vector<PairGeometry> &pairs,
+                             const QStringList &imageNames,
+                             const QVector<int> &groups,
+                             const std::vector<Camera> &cameras) {
   try {
-    if (QFileInfo::exists(dbPath))
-      QFile::remove(dbPath);
-    Database db(dbPath.toStdString());
     DatabaseTransaction transaction(&db);
 
-    const CameraModelId modelId = CameraModelId::kSimplePinhole;
-    QMap<int, camera_t> camIds;
-    QMap<int, image_t> imgIds;
-
-    QList<int> setIds = m_pointData.keys();
-    std::sort(setIds.begin(), setIds.end());
-
-    m_keypointMaps.clear();
-
-    for (int i = 0; i < m_imagePaths.size(); ++i) {
-      const auto &shape = m_imageShapes[i];
-      size_t width = static_cast<size_t>(shape.first);
-      size_t height = static_cast<size_t>(shape.second);
-      double f = 1.2 * qMax(width, height);
-      double cx = width / 2.0;
-      double cy = height / 2.0;
-      Camera cam;
-      cam.camera_id = kInvalidCameraId;
-      cam.model_id = modelId;
-      cam.width = width;
-      cam.height = height;
-      cam.params = {f, cx, cy};
-      camera_t camId = db.WriteCamera(cam);
-      camIds[i] = camId;
+    const int numImages = imageNames.size();
+    std::vector<image_t> imgIds(numImages, kInvalidImageId);
+
+    // One camera per group, shared by all of its images.
+    std::vector<camera_t> camIds;
+    for (int i = 0; i < numImages; ++i) {
+      const size_t group = static_cast<size_t>(groups[i]);
+      if (group >= camIds.size())
+        camIds.resize(group + 1, kInvalidCameraId);
+      if (camIds[group] == kInvalidCameraId)
+        camIds[group] = db.WriteCamera(cameras[i]);
 
       Image img;
-      img.SetName(QFileInfo(m_imagePaths[i]).fileName().toStdString());
-      img.SetCameraId(camId);
-      image_t imgId = db.WriteImage(img);
-      imgIds[i] = imgId;
-
-      FeatureKeypoints keypoints;
-      QMap<int, int> kpMap;
-      int kpIdx = 0;
-      for (int setId : setIds) {
-        if (m_pointData[setId].contains(i)) {
-          QPointF p = m_pointData[setId][i];
-          keypoints.emplace_back(p.x(), p.y(), 1.0f, 0.0f);
-          kpMap[setId] = kpIdx++;
-        }
-      }
+      img.SetImageId(imageIdOf(i));
+      img.SetName(imageNames[i].toStdString());
+      img.SetCameraId(camIds[group]);
+      imgIds[i] = db.WriteImage(img, /*use_image_id=*/true);
+
+      const FeatureKeypoints &keypoints = table.keypoints[i];
       if (!keypoints.empty()) {
-        db.WriteKeypoints(imgId, keypoints);
+        db.WriteKeypoints(imgIds[i], keypoints);
         FeatureDescriptors desc(keypoints.size(), 128);
         desc.setZero();
-        db.WriteDescriptors(imgId, desc);
+        db.WriteDescriptors(imgIds[i], desc);
       }
-      m_keypointMaps[i] = kpMap;
     }
 
-    for (int i = 0; i < m_imagePaths.size(); ++i) {
-      for (int j = i + 1; j < m_imagePaths.size(); ++j) {
-            QSet<int> common = QSet<int>(m_keypointMaps[i].keys().begin(), m_keypointMaps[i].keys().end()) &
-                               QSet<int>(m_keypointMaps[j].keys().begin(), m_keypointMaps[j].keys().end());
-        if (common.isEmpty())
-          continue;
-        FeatureMatches matches;
-        for (int setId : common) {
-          matches.emplace_back(m_keypointMaps[i][setId],
-                               m_keypointMaps[j][setId]);
-        }
-        db.WriteMatches(imgIds[i], imgIds[j], matches);
-        TwoViewGeometry geom;
-        geom.config = TwoViewGeometry::CALIBRATED;
-        geom.inlier_matches = matches;
-        db.WriteTwoViewGeometry(imgIds[i], imgIds[j], geom);
-      }
+    for (const PairGeometry &pair : pairs) {
+      const image_t id1 = imgIds[pair.key >> 32];
+      const image_t id2 = imgIds[pair.key & 0xFFFFFFFFu];
+      db.WriteMatches(id1, id2, pair.matches);
+      db.WriteTwoViewGeometry(id1, id2, pair.geometry);
     }
   } catch (...) {
     return false;
@@ -113,25 +499,219 @@ bool CameraCalibrator::populateDatabase(const QString &dbPath) {
   return true;
 }
 
-bool CameraCalibrator::calibrate() {
-  if (m_imagePaths.size() < 2 || m_pointData.size() < 3)
-    return false;
+namespace {
 
-  QString workDir = QDir::temp().filePath("colmap_cpp_work");
-  QDir().rmdir(workDir); // remove old
-  QDir().mkpath(workDir);
-  QString dbPath = QDir(workDir).filePath("database.db");
-  QString imgDir = QDir(workDir).filePath("images");
-  QDir().mkpath(imgDir);
-  for (const QString &p : m_imagePaths)
-    QFile::copy(p, QDir(imgDir).filePath(QFileInfo(p).fileName()));
+// Hooks into the mapper loop for progress reporting and cancellation.
+struct MapperHooks {
+  std::function<bool()> isCancelled;
+  std::function<void(CalibrationProgress::Stage, const Reconstruction &)>
+      report;
+  ceres::IterationCallback *baCallback = nullptr;
+};
 
-  if (!populateDatabase(dbPath))
-    return false;
+// Counts bundle adjustment iterations and aborts the solver on cancel.
+class BundleAdjustmentMonitor : public ceres::IterationCallback {
+public:
+  explicit BundleAdjustmentMonitor(std::function<bool(int)> onIteration)
+      : m_onIteration(std::move(onIteration)) {}
+
+  ceres::CallbackReturnType
+  operator()(const ceres::IterationSummary &summary) override {
+    return m_onIteration(summary.iteration) ? ceres::SOLVER_CONTINUE
+                                            : ceres::SOLVER_ABORT;
+  }
+
+private:
+  std::function<bool(int)> m_onIteration;
+};
+
+} // namespace
+
+// More registered images wins; ties go to the lower mean reprojection error.
+static bool isBetterModel(const Reconstruction &candidate,
+                          const Reconstruction &best) {
+  if (candidate.NumRegImages() != best.NumRegImages())
+    return candidate.NumRegImages() > best.NumRegImages();
+  return candidate.ComputeMeanReprojectionError() <
+         best.ComputeMeanReprojectionError();
+}
+
+// Runs the incremental mapper directly on a database cache. This mirrors
+// IncrementalPipeline::Reconstruct(), which can only load its database from
+// a path and therefore cannot see an in-memory database.
+static std::shared_ptr<Reconstruction>
+reconstructIncremental(const std::shared_ptr<const DatabaseCache> &cache,
+                       const IncrementalPipelineOptions &options,
+                       const MapperHooks &hooks) {
+  const IncrementalMapper::Options mapperOptions = options.Mapper();
+  BundleAdjustmentOptions localBa = options.LocalBundleAdjustment();
+  BundleAdjustmentOptions globalBa = options.GlobalBundleAdjustment();
+  if (hooks.baCallback) {
+    localBa.solver_options.callbacks.push_back(hooks.baCallback);
+    globalBa.solver_options.callbacks.push_back(hooks.baCallback);
+  }
+  IncrementalMapper mapper(cache);
+  std::shared_ptr<Reconstruction> best;
+
+  for (int trial = 0; trial < options.init_num_trials; ++trial) {
+    if (hooks.isCancelled())
+      break;
+    auto reconstruction = std::make_shared<Reconstruction>();
+    mapper.BeginReconstruction(reconstruction);
+    hooks.report(CalibrationProgress::Initializing, *reconstruction);
+
+    // A fixed initial pair fails the same way on every trial.
+    const bool fixedPair =
+        options.init_image_id1 != -1 && options.init_image_id2 != -1;
+    TwoViewGeometry twoViewGeometry;
+    image_t imageId1 = static_cast<image_t>(options.init_image_id1);
+    image_t imageId2 = static_cast<image_t>(options.init_image_id2);
+    const bool found =
+        fixedPair ? mapper.EstimateInitialTwoViewGeometry(
+                        mapperOptions, twoViewGeometry, imageId1, imageId2)
+                  : mapper.FindInitialImagePair(mapperOptions, twoViewGeometry,
+                                                imageId1, imageId2);
+    if (!found) {
+      mapper.EndReconstruction(/*discard=*/true);
+      break;
+    }
+    if (!mapper.RegisterInitialImagePair(mapperOptions, twoViewGeometry,
+                                         imageId1, imageId2)) {
+      mapper.EndReconstruction(/*discard=*/true);
+      if (fixedPair)
+        break;
+      continue;
+    }
+    mapper.AdjustGlobalBundle(mapperOptions, globalBa);
+    mapper.FilterPoints(mapperOptions);
+    mapper.FilterImages(mapperOptions);
+    if (reconstruction->NumRegImages() == 0 ||
+        reconstruction->NumPoints3D() == 0) {
+      mapper.EndReconstruction(/*discard=*/true);
+      continue;
+    }
+    hooks.report(CalibrationProgress::Registering, *reconstruction);
+
+    // Global adjustment runs whenever the model has grown by the ratios or
+    // counts the options give, like in COLMAP's own pipeline.
+    size_t globalBaImages = reconstruction->NumRegImages();
+    size_t globalBaPoints = reconstruction->NumPoints3D();
+    bool registered = true;
+    while (registered && !hooks.isCancelled()) {
+      registered = false;
+      for (image_t next : mapper.FindNextImages(mapperOptions)) {
+        if (!mapper.RegisterNextImage(mapperOptions, next))
+          continue;
+        mapper.TriangulateImage(options.Triangulation(), next);
+        mapper.IterativeLocalRefinement(
+            options.ba_local_max_refinements,
+            options.ba_local_max_refinement_change, mapperOptions, localBa,
+            options.Triangulation(), next);
+        const size_t numImages = reconstruction->NumRegImages();
+        const size_t numPoints = reconstruction->NumPoints3D();
+        if (numImages >= options.ba_global_images_ratio * globalBaImages ||
+            numImages >= options.ba_global_images_freq + globalBaImages ||
+            numPoints >= options.ba_global_points_ratio * globalBaPoints ||
+            numPoints >= options.ba_global_points_freq + globalBaPoints) {
+          mapper.IterativeGlobalRefinement(
+              options.ba_global_max_refinements,
+              options.ba_global_max_refinement_change, mapperOptions,
+              globalBa, options.Triangulation());
+          globalBaImages = reconstruction->NumRegImages();
+          globalBaPoints = reconstruction->NumPoints3D();
+        }
+        hooks.report(CalibrationProgress::Registering, *reconstruction);
+        registered = true;
+        break;
+      }
+    }
+    if (hooks.isCancelled()) {
+      mapper.EndReconstruction(/*discard=*/true);
+      break;
+    }
+    hooks.report(CalibrationProgress::Refining, *reconstruction);
+    mapper.IterativeGlobalRefinement(
+        options.ba_global_max_refinements,
+        options.ba_global_max_refinement_change, mapperOptions, globalBa,
+        options.Triangulation());
+    mapper.EndReconstruction(/*discard=*/false);
+
+    if (!best || isBetterModel(*reconstruction, *best))
+      best = reconstruction;
+    if (best->NumRegImages() == cache->NumImages())
+      break;
+  }
+  return best;
+}
+
+void CameraCalibrator::setProgressCallback(ProgressCallback callback) {
+  m_progressCallback = std::move(callback);
+}
+
+void CameraCalibrator::requestCancel() { m_cancelRequested = true; }
+
+void CameraCalibrator::setMultiStartRuns(int runs) {
+  m_multiStartRuns = std::max(1, runs);
+}
+
+void CameraCalibrator::setPartitionSize(int maxImages) {
+  m_partitionSize = std::max(3, maxImages);
+}
+
+// Publishes the current stage. When a reconstruction is given, the list of
+// registered images and their centres is refreshed from it.
+void CameraCalibrator::reportProgress(CalibrationProgress::Stage stage,
+                                      const Reconstruction *rec) {
+  m_progress.stage = stage;
+  if (rec) {
+    m_progress.registeredIndices.clear();
+    m_progress.cameraCenters.clear();
+    for (image_t id : rec->RegImageIds()) {
+      const int idx = indexOfImage(id, m_imagePaths.size());
+      if (idx < 0)
+        continue;
+      const Eigen::Vector3d c = rec->Image(id).ProjectionCenter();
+      m_progress.registeredIndices.append(idx);
+      m_progress.cameraCenters.append(QVector3D(c.x(), c.y(), c.z()));
+    }
+    m_progress.baIterations = 0;
+  }
+  if (m_progressCallback)
+    m_progressCallback(m_progress);
+}
+
+QString calibrationProfileName(CalibrationProfile profile) {
+  switch (profile) {
+  case CalibrationProfile::InteractiveFast:
+    return QStringLiteral("interactive-fast");
+  case CalibrationProfile::Balanced:
+    return QStringLiteral("balanced");
+  case CalibrationProfile::FinalAccurate:
+    return QStringLiteral("final-accurate");
+  }
+  return QString();
+}
 
-  QString sparseDir = QDir(workDir).filePath("sparse");
-  QDir().mkpath(sparseDir);
+bool parseCalibrationProfile(const QString &name,
+                             CalibrationProfile *profile) {
+  for (CalibrationProfile p :
+       {CalibrationProfile::InteractiveFast, CalibrationProfile::Balanced,
+        CalibrationProfile::FinalAccurate}) {
+    if (name == calibrationProfileName(p)) {
+      *profile = p;
+      return true;
+    }
+  }
+  return false;
+}
 
+// Locator tracks are few and clean compared to feature matches, so the
+// mapper accepts much smaller pairs and poses than it would by default.
+// The profile then sets how hard bundle adjustment works: interactive-fast
+// caps iterations and runs global adjustment rarely, final-accurate
+// iterates longer, adjusts globally more often and keeps two-view tracks.
+static IncrementalPipelineOptions
+calibrationOptions(CalibrationProfile profile, int numThreads) {
   IncrementalPipelineOptions options;
   options.min_num_matches = 3;
   options.mapper.init_min_num_inliers = 3;
@@ -140,159 +720,1057 @@ bool CameraCalibrator::calibrate() {
   options.mapper.abs_pose_max_error = 24.0;
   options.mapper.filter_min_tri_angle = 0.0;
 
-  auto optPtr = std::make_shared<IncrementalPipelineOptions>(options);
-  auto recManager = std::make_shared<ReconstructionManager>();
-  IncrementalPipeline pipeline(optPtr, imgDir.toStdString(),
-                               dbPath.toStdString(), recManager);
-  pipeline.Run();
+  const int cores =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  switch (profile) {
+  case CalibrationProfile::InteractiveFast:
+    // One core stays free for the UI.
+    options.num_threads = std::max(1, cores - 1);
+    options.init_num_trials = 50;
+    options.ba_local_max_num_iterations = 10;
+    options.ba_local_max_refinements = 1;
+    options.ba_global_max_num_iterations = 20;
+    options.ba_global_max_refinements = 1;
+    options.ba_global_images_ratio = 1.5;
+    options.ba_global_points_ratio = 1.5;
+    options.ba_global_images_freq = 1000;
+    options.ba_global_points_freq = 500000;
+    break;
+  case CalibrationProfile::Balanced:
+    options.num_threads = cores;
+    break;
+  case CalibrationProfile::FinalAccurate:
+    options.num_threads = cores;
+    options.ba_local_max_num_iterations = 50;
+    options.ba_local_max_refinements = 3;
+    options.ba_global_max_num_iterations = 100;
+    options.ba_global_max_refinements = 10;
+    options.ba_global_max_refinement_change = 0.0001;
+    options.ba_global_images_ratio = 1.05;
+    options.ba_global_points_ratio = 1.05;
+    options.triangulation.ignore_two_view_tracks = false;
+    break;
+  }
+  if (numThreads > 0)
+    options.num_threads = numThreads;
+  return options;
+}
+
+// Passes of triangulation outlier rejection after the solve.
+static int outlierPasses(CalibrationProfile profile) {
+  switch (profile) {
+  case CalibrationProfile::InteractiveFast:
+    return 1;
+  case CalibrationProfile::Balanced:
+    return 3;
+  case CalibrationProfile::FinalAccurate:
+    return 5;
+  }
+  return 3;
+}
+
+bool CameraCalibrator::calibrate() { return solve(false); }
+
+bool CameraCalibrator::refine() { return solve(m_solution != nullptr); }
+
+void CameraCalibrator::setRejectOutliers(bool reject) {
+  m_rejectOutliers = reject;
+}
+
+void CameraCalibrator::setOutlierThreshold(double pixels) {
+  m_outlierThreshold = pixels;
+}
+
+// Milliseconds since the timer was last started; restarts it.
+static double lap(QElapsedTimer &timer) {
+  const double ms = timer.nsecsElapsed() / 1e6;
+  timer.restart();
+  return ms;
+}
+
+void CameraCalibrator::rejectObservations(
+    const QVector<LocatorObservation> &observations) {
+  for (const LocatorObservation &obs : observations) {
+    const QPointF click = m_pointData.value(obs.locator).value(obs.image);
+    m_rejectedPoints[obs.locator].insert(obs.image, click);
+  }
+  m_outliers += observations;
+  removeObservations(&m_pointData, observations);
+}
+
+// Fewest locators a solve is attempted with.
+static const int kMinSolveLocators = 3;
+
+bool CameraCalibrator::solve(bool warmStart) {
+  const int maxOutlierPasses = outlierPasses(m_profile);
+  QElapsedTimer total;
+  total.start();
+  QElapsedTimer phase;
+  phase.start();
+  m_timings = CalibrationTimings();
+  m_cancelRequested = false;
+  m_outliers.clear();
+  m_rejectedPoints.clear();
+  if (m_rejectOutliers) {
+    const std::vector<Camera> cameras =
+        groupCameras(cameraGroups(), m_imageShapes, m_imageExif);
+    const QVector<LocatorObservation> found =
+        findEpipolarOutliers(m_pointData, cameras, m_outlierThreshold,
+                             m_numThreads);
+    // Rejection must not leave the solve without enough locators.
+    QMap<int, QMap<int, QPointF>> remaining = m_pointData;
+    removeObservations(&remaining, found);
+    if (remaining.size() >= kMinSolveLocators)
+      rejectObservations(found);
+    m_timings.outlierRejection += lap(phase);
+  }
+
+  bool ok = warmStart ? solveWarm() : solveFromScratch();
+
+  // Clicks that disagree with the solved cameras are dropped and the
+  // solution is refined without them. A pass that leaves too few locators
+  // or whose refinement fails is undone, so the solution found so far
+  // stands.
+  for (int pass = 0; ok && m_rejectOutliers && pass < maxOutlierPasses;
+       ++pass) {
+    phase.restart();
+    const QVector<LocatorObservation> found =
+        findTriangulationOutliers(m_pointData, getProjections(),
+                                  m_outlierThreshold, m_numThreads);
+    if (found.isEmpty()) {
+      m_timings.outlierRejection += lap(phase);
+      break;
+    }
+    const QMap<int, QMap<int, QPointF>> pointData = m_pointData;
+    const QVector<LocatorObservation> outliers = m_outliers;
+    const QMap<int, QMap<int, QPointF>> rejectedPoints = m_rejectedPoints;
+    const std::vector<CameraSolution> cameras = m_cameras;
+    const QVector<int> registeredIndices = m_registeredIndices;
+    const std::shared_ptr<Solution> solution = m_solution;
+    const QString workspacePath = m_workspacePath;
+    rejectObservations(found);
+    m_timings.outlierRejection += lap(phase);
+    if (m_pointData.size() >= kMinSolveLocators && solveWarm())
+      continue;
+    m_pointData = pointData;
+    m_outliers = outliers;
+    m_rejectedPoints = rejectedPoints;
+    m_cameras = cameras;
+    m_registeredIndices = registeredIndices;
+    m_solution = solution;
+    m_workspacePath = workspacePath;
+    break;
+  }
+  m_timings.total = lap(total);
+  return ok;
+}
 
-  if (recManager->Size() == 0)
+bool CameraCalibrator::solveFromScratch() {
+  if (m_imagePaths.size() < 2 || m_pointData.size() < kMinSolveLocators)
     return false;
-  std::shared_ptr<Reconstruction> best = recManager->Get(0);
-  for (size_t i = 1; i < recManager->Size(); ++i) {
-    if (recManager->Get(i)->NumRegImages() > best->NumRegImages())
-      best = recManager->Get(i);
+
+  m_progress = CalibrationProgress();
+  m_progress.totalImages = m_imagePaths.size();
+  reportProgress(CalibrationProgress::Preparing, nullptr);
+
+  if (m_solver != Solver::Incremental) {
+    const bool partitioned = m_solver == Solver::Partitioned &&
+                             m_imagePaths.size() > m_partitionSize;
+    if (partitioned ? calibratePartitioned() : calibrateDirect()) {
+      reportProgress(CalibrationProgress::Finished, nullptr);
+      return true;
+    }
+    if (m_cancelRequested)
+      return false;
   }
-  if (best->NumRegImages() < 2)
+
+  // The mapper only needs image names and sizes; pixels are never read, so
+  // the source images are not copied anywhere. Every run gets its own
+  // in-memory database that only lives for this call.
+  // The pair geometry is estimated once and shared by all runs.
+  QElapsedTimer phase;
+  phase.start();
+  const IncrementalPipelineOptions options =
+      calibrationOptions(m_profile, m_numThreads);
+  const int numRuns = std::max(1, m_multiStartRuns);
+  const TrackTable table =
+      buildTrackTable(m_pointData, m_imagePaths.size(), &m_keypointSetIds);
+  const QVector<int> groups = cameraGroups();
+  const std::vector<Camera> cameras =
+      groupCameras(groups, m_imageShapes, m_imageExif);
+  const std::vector<PairGeometry> pairs =
+      estimatePairGeometries(table, cameras, m_outlierThreshold, m_numThreads);
+  std::vector<std::unique_ptr<Database>> databases;
+  for (int run = 0; run < numRuns; ++run) {
+    databases.push_back(
+        std::make_unique<Database>(Database::kInMemoryDatabasePath));
+    if (!populateDatabase(*databases.back(), table, pairs, m_imageNames,
+                          groups, cameras))
+      return false;
+  }
+
+  // Run 0 lets the mapper choose its initial pair, which is almost always
+  // the pair with the most verified matches. Run k starts from the pair
+  // ranked k, so no run repeats that choice, with its own random seed.
+  std::vector<uint64_t> initialPairs;
+  if (numRuns > 1)
+    initialPairs = pairsByInlierCount(
+        pairs, static_cast<size_t>(options.mapper.init_min_num_inliers));
+  const int threadsPerRun = std::max(1, options.num_threads / numRuns);
+  m_timings.preparation += lap(phase);
+
+  // Only run 0 reports progress; the others just honour cancellation.
+  BundleAdjustmentMonitor baMonitor(
+      [this](int iteration) { return onBundleAdjustmentIteration(iteration); });
+  BundleAdjustmentMonitor cancelMonitor(
+      [this](int) { return !m_cancelRequested; });
+  std::vector<std::shared_ptr<Reconstruction>> results(numRuns);
+  parallelFor(numRuns, [&](int run) {
+    std::shared_ptr<const DatabaseCache> cache =
+        DatabaseCache::Create(*databases[run], options.min_num_matches,
+                              options.ignore_watermarks, {});
+    IncrementalPipelineOptions runOptions = options;
+    if (numRuns > 1)
+      runOptions.num_threads = threadsPerRun;
+    if (run > 0) {
+      if (static_cast<size_t>(run) >= initialPairs.size())
+        return;
+      const uint64_t key = initialPairs[run];
+      runOptions.init_image_id1 = static_cast<int>(imageIdOf(key >> 32));
+      runOptions.init_image_id2 =
+          static_cast<int>(imageIdOf(key & 0xFFFFFFFFu));
+      SetPRNGSeed(static_cast<unsigned>(run));
+    }
+
+    MapperHooks hooks;
+    hooks.isCancelled = [this]() { return m_cancelRequested.load(); };
+    if (run == 0) {
+      hooks.baCallback = &baMonitor;
+      hooks.report = [this](CalibrationProgress::Stage stage,
+                            const Reconstruction &rec) {
+        reportProgress(stage, &rec);
+      };
+    } else {
+      hooks.baCallback = &cancelMonitor;
+      hooks.report = [](CalibrationProgress::Stage, const Reconstruction &) {};
+    }
+    results[run] = reconstructIncremental(cache, runOptions, hooks);
+  }, 1, options.num_threads);
+  m_timings.reconstruction += lap(phase);
+
+  std::shared_ptr<Reconstruction> best;
+  for (const std::shared_ptr<Reconstruction> &result : results) {
+    if (result && (!best || isBetterModel(*result, *best)))
+      best = result;
+  }
+  if (m_cancelRequested || !best || best->NumRegImages() < 2)
     return false;
 
-  m_intrinsics.clear();
-  m_rotations.clear();
-  m_translations.clear();
-  m_registeredIndices.clear();
+  storeSolution(best);
+  m_timings.extraction += lap(phase);
+  reportProgress(CalibrationProgress::Finished, nullptr);
+  return true;
+}
 
-  Database db(dbPath.toStdString());
-  std::unordered_map<std::string, image_t> nameToId;
-  for (const auto &img : db.ReadAllImages()) {
-    nameToId[img.Name()] = img.ImageId();
+// Linear triangulation of one track from the current poses of the images
+// observing it. Fails when the point ends up behind any of the cameras.
+static bool triangulateTrack(const Reconstruction &rec,
+                             const std::vector<TrackElement> &elements,
+                             Eigen::Vector3d *xyz) {
+  LinearTriangulator triangulator;
+  for (const TrackElement &el : elements) {
+    const Image &img = rec.Image(el.image_id);
+    const ProjectionMatrix P = rec.Camera(img.CameraId()).CalibrationMatrix() *
+                               img.CamFromWorld().ToMatrix();
+    const Eigen::Vector2d &x = img.Point2D(el.point2D_idx).xy;
+    triangulator.addView(P, x(0), x(1));
+  }
+  if (!triangulator.solve(xyz))
+    return false;
+  for (const TrackElement &el : elements) {
+    if ((rec.Image(el.image_id).CamFromWorld() * *xyz).z() <= 0)
+      return false;
   }
+  return true;
+}
 
-  for (const auto &pair : best->Images()) {
-    image_t imgId = pair.first;
-    const Image &img = pair.second;
-    QString name = QString::fromStdString(img.Name());
-    int idx = m_imagePaths.indexOf(QDir(m_imagePaths[0]).filePath(name));
-    if (idx < 0)
-      idx = m_imagePaths.indexOf(name);
+namespace {
+
+// Reconstruction assembled straight from the locator tracks, without the
+// incremental mapper. Image ids are index + 1, camera ids camera group + 1,
+// and the 2D points of every image follow the track table.
+class TrackModel {
+public:
+  TrackModel(const TrackTable &table, const QStringList &names,
+             const std::vector<Camera> &cameras, const QVector<int> &groups)
+      : m_table(table), m_groups(groups),
+        m_rec(std::make_shared<Reconstruction>()),
+        m_pointOfTrack(table.tracks.size(), kInvalidPoint3DId) {
+    for (int i = 0; i < names.size(); ++i) {
+      if (!m_rec->ExistsCamera(cameraId(i))) {
+        Camera cam = cameras[i];
+        cam.camera_id = cameraId(i);
+        m_rec->AddCamera(cam);
+      }
+
+      Image img;
+      img.SetImageId(imageId(i));
+      img.SetName(names[i].toStdString());
+      img.SetCameraId(cameraId(i));
+      img.SetPoints2D(keypointPositions(table.keypoints[i]));
+      m_rec->AddImage(std::move(img));
+    }
+  }
+
+  static image_t imageId(int index) { return imageIdOf(index); }
+  camera_t cameraId(int index) const {
+    return static_cast<camera_t>(m_groups[index] + 1);
+  }
+  Reconstruction &reconstruction() { return *m_rec; }
+  const Reconstruction &reconstruction() const { return *m_rec; }
+  const std::shared_ptr<Reconstruction> &shared() const { return m_rec; }
+  bool isRegistered(int index) const {
+    return m_rec->IsImageRegistered(imageId(index));
+  }
+  bool hasPoint(size_t track) const {
+    return m_pointOfTrack[track] != kInvalidPoint3DId;
+  }
+  const Eigen::Vector3d &point(size_t track) const {
+    return m_rec->Point3D(m_pointOfTrack[track]).xyz;
+  }
+
+  void setCamera(int index, Camera camera) {
+    camera.camera_id = cameraId(index);
+    m_rec->Camera(camera.camera_id) = camera;
+  }
+
+  void registerImage(int index, const Rigid3d &camFromWorld) {
+    m_rec->Image(imageId(index)).CamFromWorld() = camFromWorld;
+    m_rec->RegisterImage(imageId(index));
+    ++m_cameraUsers[cameraId(index)];
+  }
+
+  // Adds the point of a track with its observations in registered images.
+  void addPoint(size_t track, const Eigen::Vector3d &xyz) {
+    Track t;
+    for (const TrackElement &el : registeredElements(track))
+      t.AddElement(el);
+    m_pointOfTrack[track] = m_rec->AddPoint3D(xyz, std::move(t));
+  }
+
+  // Number of triangulated locators seen by an image.
+  int numVisiblePoints(int index) const {
+    int n = 0;
+    for (int track : m_table.keypointTracks[index]) {
+      if (track >= 0 && hasPoint(track))
+        ++n;
+    }
+    return n;
+  }
+
+  // Registers an image by PnP against the triangulated locators it sees and
+  // adds its inlier observations to their tracks.
+  bool registerByPnP(int index, const IncrementalMapper::Options &options) {
+    const image_t id = imageId(index);
+    const std::vector<int> &tracks = m_table.keypointTracks[index];
+    std::vector<Eigen::Vector2d> points2D;
+    std::vector<Eigen::Vector3d> points3D;
+    std::vector<point2D_t> point2DIdxs;
+    for (size_t k = 0; k < tracks.size(); ++k) {
+      if (tracks[k] < 0 || !hasPoint(tracks[k]))
+        continue;
+      points2D.push_back(m_rec->Image(id).Point2D(k).xy);
+      points3D.push_back(m_rec->Point3D(m_pointOfTrack[tracks[k]]).xyz);
+      point2DIdxs.push_back(static_cast<point2D_t>(k));
+    }
+    const size_t minInliers =
+        std::max<size_t>(4, options.abs_pose_min_num_inliers);
+    if (points2D.size() < minInliers)
+      return false;
+
+    // The focal length of a shared camera is already fixed by the images
+    // registered with it and must not be re-estimated from this one.
+    AbsolutePoseEstimationOptions poseOptions;
+    poseOptions.estimate_focal_length = m_cameraUsers[cameraId(index)] == 0;
+    poseOptions.ransac_options.max_error = options.abs_pose_max_error;
+    Camera camera = m_rec->Camera(cameraId(index));
+    Rigid3d camFromWorld;
+    size_t numInliers = 0;
+    std::vector<char> inlierMask;
+    if (!EstimateAbsolutePose(poseOptions, points2D, points3D, &camFromWorld,
+                              &camera, &numInliers, &inlierMask) ||
+        numInliers < minInliers)
+      return false;
+    m_rec->Camera(cameraId(index)) = camera;
+    registerImage(index, camFromWorld);
+    for (size_t k = 0; k < point2DIdxs.size(); ++k) {
+      if (inlierMask[k])
+        m_rec->AddObservation(m_pointOfTrack[tracks[point2DIdxs[k]]],
+                              TrackElement(id, point2DIdxs[k]));
+    }
+    return true;
+  }
+
+  // Triangulates every track without a point that is seen by at least two
+  // registered images. Images observing a new point are added to touched.
+  void triangulatePending(std::unordered_set<image_t> *touched) {
+    for (size_t t = 0; t < m_pointOfTrack.size(); ++t) {
+      if (hasPoint(t))
+        continue;
+      const std::vector<TrackElement> elements = registeredElements(t);
+      Eigen::Vector3d xyz;
+      if (elements.size() < 2 || !triangulateTrack(*m_rec, elements, &xyz))
+        continue;
+      addPoint(t, xyz);
+      if (touched) {
+        for (const TrackElement &el : elements)
+          touched->insert(el.image_id);
+      }
+    }
+  }
+
+  // Removes points with fewer than two registered observations; they would
+  // be unconstrained in bundle adjustment.
+  void dropWeakPoints() {
+    for (point3D_t &id : m_pointOfTrack) {
+      if (id != kInvalidPoint3DId && m_rec->Point3D(id).track.Length() < 2) {
+        m_rec->DeletePoint3D(id);
+        id = kInvalidPoint3DId;
+      }
+    }
+  }
+
+private:
+  std::vector<TrackElement> registeredElements(size_t track) const {
+    std::vector<TrackElement> elements;
+    for (const auto &obs : m_table.tracks[track]) {
+      if (isRegistered(obs.first))
+        elements.emplace_back(imageId(obs.first), obs.second);
+    }
+    return elements;
+  }
+
+  const TrackTable &m_table;
+  QVector<int> m_groups;
+  std::shared_ptr<Reconstruction> m_rec;
+  std::vector<point3D_t> m_pointOfTrack;
+  std::unordered_map<camera_t, int> m_cameraUsers;
+};
+
+} // namespace
+
+// Adjusts every registered image. The gauge is fixed like in the mapper's
+// global adjustment: the first pose is constant and so is one coordinate of
+// the second camera's position.
+static BundleAdjustmentConfig globalConfig(const Reconstruction &rec) {
+  const std::vector<image_t> regIds(rec.RegImageIds().begin(),
+                                    rec.RegImageIds().end());
+  BundleAdjustmentConfig config;
+  for (image_t id : regIds)
+    config.AddImage(id);
+  config.SetConstantCamPose(regIds[0]);
+  config.SetConstantCamPositions(regIds[1], {0});
+  return config;
+}
+
+// Runs one bundle adjustment. Fails when Ceres reports a result that must not
+// be kept, e.g. after a numerical failure or when it was aborted.
+static bool solveBundleAdjustment(const BundleAdjustmentOptions &options,
+                                  const BundleAdjustmentConfig &config,
+                                  Reconstruction &rec) {
+  return CreateDefaultBundleAdjuster(options, config, rec)
+      ->Solve()
+      .IsSolutionUsable();
+}
+
+bool CameraCalibrator::onBundleAdjustmentIteration(int iteration) {
+  m_progress.baIterations = iteration;
+  reportProgress(m_progress.stage, nullptr);
+  return !m_cancelRequested;
+}
+
+bool CameraCalibrator::solveWarm() {
+  const int numImages = m_imagePaths.size();
+  if (numImages < 2 || m_pointData.size() < kMinSolveLocators)
+    return false;
+
+  m_progress = CalibrationProgress();
+  m_progress.totalImages = numImages;
+  reportProgress(CalibrationProgress::Preparing, nullptr);
+  QElapsedTimer phase;
+  phase.start();
+
+  // Images solved last time keep their camera and pose.
+  const TrackTable table =
+      buildTrackTable(m_pointData, numImages, &m_keypointSetIds);
+  const QVector<int> groups = cameraGroups();
+  TrackModel model(table, m_imageNames,
+                   groupCameras(groups, m_imageShapes, m_imageExif), groups);
+  // The image list may have changed since, so previous indices are matched
+  // by path.
+  const Reconstruction &previous = *m_solution->reconstruction;
+  const QStringList &previousPaths = m_solution->imagePaths;
+  QHash<QString, int> indexByPath;
+  for (int i = 0; i < numImages; ++i)
+    indexByPath.insert(m_imagePaths[i], i);
+  for (image_t id : previous.RegImageIds()) {
+    const int previousIdx = indexOfImage(id, previousPaths.size());
+    const int idx =
+        previousIdx < 0 ? -1 : indexByPath.value(previousPaths[previousIdx], -1);
     if (idx < 0)
       continue;
-    const Camera &cam = best->Camera(img.CameraId());
-    if (cam.model_id == CameraModelId::kSimplePinhole &&
-        cam.params.size() == 3) {
-      QMatrix3x3 K;
-      K(0, 0) = cam.params[0];
-      K(0, 1) = 0;
-      K(0, 2) = cam.params[1];
-      K(1, 0) = 0;
-      K(1, 1) = cam.params[0];
-      K(1, 2) = cam.params[2];
-      K(2, 0) = 0;
-      K(2, 1) = 0;
-      K(2, 2) = 1;
-      if (m_intrinsics.size() <= idx)
-        m_intrinsics.resize(idx + 1);
-      m_intrinsics[idx] = K;
-    }
-    Rigid3d pose = img.CamFromWorld();
-    Eigen::Matrix3d Rcw = pose.rotation.toRotationMatrix();
-    Eigen::Vector3d tcw = pose.translation;
-    Eigen::Matrix3d Rwc = Rcw.transpose();
-    Eigen::Vector3d twc = -Rwc * tcw;
-    QMatrix3x3 Rmat;
-    for (int r = 0; r < 3; ++r)
-      for (int c = 0; c < 3; ++c)
-        Rmat(r, c) = Rwc(r, c);
-    QVector3D tvec(twc(0), twc(1), twc(2));
-    if (m_rotations.size() <= idx)
-      m_rotations.resize(idx + 1);
-    if (m_translations.size() <= idx)
-      m_translations.resize(idx + 1);
-    m_rotations[idx] = Rmat;
-    m_translations[idx] = tvec;
-    m_registeredIndices.append(idx);
+    const Image &img = previous.Image(id);
+    model.setCamera(idx, previous.Camera(img.CameraId()));
+    model.registerImage(idx, img.CamFromWorld());
+  }
+
+  // Locators whose observations did not change keep their 3D position.
+  for (size_t t = 0; t < table.tracks.size(); ++t) {
+    const int setId = table.trackSetIds[t];
+    auto known = m_solution->setPoints.find(setId);
+    if (known != m_solution->setPoints.end() &&
+        m_solution->pointData.value(setId) == m_pointData.value(setId))
+      model.addPoint(t, known->second);
+  }
+
+  m_timings.preparation += lap(phase);
+
+  // Images that were not solved before are registered against those
+  // points, then new and edited locators are triangulated.
+  std::unordered_set<image_t> changedImages;
+  const IncrementalPipelineOptions options =
+      calibrationOptions(m_profile, m_numThreads);
+  for (int i = 0; i < numImages && !m_cancelRequested; ++i) {
+    if (!model.isRegistered(i) && model.registerByPnP(i, options.mapper))
+      changedImages.insert(TrackModel::imageId(i));
+  }
+  model.dropWeakPoints();
+  model.triangulatePending(&changedImages);
+  Reconstruction &rec = model.reconstruction();
+  m_timings.reconstruction += lap(phase);
+  if (m_cancelRequested || rec.NumRegImages() < 2)
+    return false;
+
+  // Only the images touched by the edit move when they are a minority; the
+  // rest stay fixed and also fix the gauge. A shared camera stays variable
+  // as long as one of its images changed.
+  const size_t numRegImages = rec.NumRegImages();
+  const bool local = changedImages.size() * 2 <= numRegImages &&
+                     numRegImages - changedImages.size() >= 2;
+  BundleAdjustmentConfig config;
+  if (local) {
+    std::unordered_set<camera_t> changedCameras;
+    for (image_t id : changedImages)
+      changedCameras.insert(rec.Image(id).CameraId());
+    for (image_t id : rec.RegImageIds()) {
+      config.AddImage(id);
+      if (!changedImages.count(id))
+        config.SetConstantCamPose(id);
+      if (!changedCameras.count(rec.Image(id).CameraId()))
+        config.SetConstantCamIntrinsics(rec.Image(id).CameraId());
+    }
+  } else {
+    config = globalConfig(rec);
   }
 
+  BundleAdjustmentOptions baOptions = local ? options.LocalBundleAdjustment()
+                                            : options.GlobalBundleAdjustment();
+  BundleAdjustmentMonitor baMonitor(
+      [this](int iteration) { return onBundleAdjustmentIteration(iteration); });
+  baOptions.solver_options.num_threads = options.num_threads;
+  baOptions.solver_options.callbacks.push_back(&baMonitor);
+  reportProgress(CalibrationProgress::Refining, &rec);
+  phase.restart();
+  const bool usable = solveBundleAdjustment(baOptions, config, rec);
+  m_timings.bundleAdjustment += lap(phase);
+  if (m_cancelRequested)
+    return false;
+  // A failed refinement must not replace the previous solution; solve the
+  // edited project from scratch instead.
+  if (!usable)
+    return solveFromScratch();
+
+  storeSolution(model.shared());
+  m_timings.extraction += lap(phase);
+  reportProgress(CalibrationProgress::Finished, nullptr);
   return true;
 }
 
-static Eigen::Vector3d
-triangulatePoint(const QMap<int, QPointF> &obs,
-                 const QMap<int, Eigen::Matrix<double, 3, 4>> &P) {
-  std::vector<Eigen::Vector4d> rows;
-  for (auto it = obs.begin(); it != obs.end(); ++it) {
-    int idx = it.key();
-    if (!P.contains(idx))
+// Tries the pairs sharing the most locators first and registers the first
+// one with a well conditioned relative pose as the initial pair. When
+// allowed is not empty, only pairs of images flagged in it are tried.
+static bool initializeFromBestPair(TrackModel &model, const TrackTable &table,
+                                   const IncrementalMapper::Options &options,
+                                   const std::vector<char> &allowed = {}) {
+  static const size_t kMaxPairTrials = 20;
+  const std::unordered_map<uint64_t, FeatureMatches> pairMatches =
+      buildPairMatches(table);
+  const std::vector<uint64_t> candidates = pairsByMatchCount(
+      pairMatches, std::max<size_t>(5, options.init_min_num_inliers));
+
+  TwoViewGeometryOptions geometryOptions;
+  geometryOptions.min_num_inliers = 5;
+  geometryOptions.ransac_options.max_error = options.init_max_error;
+  const Reconstruction &rec = model.reconstruction();
+  size_t trials = 0;
+  for (size_t c = 0; c < candidates.size() && trials < kMaxPairTrials; ++c) {
+    const uint64_t key = candidates[c];
+    const int index1 = static_cast<int>(key >> 32);
+    const int index2 = static_cast<int>(key & 0xFFFFFFFFu);
+    if (!allowed.empty() && (!allowed[index1] || !allowed[index2]))
+      continue;
+    ++trials;
+    const Camera &camera1 = rec.Camera(model.cameraId(index1));
+    const Camera &camera2 = rec.Camera(model.cameraId(index2));
+    const std::vector<Eigen::Vector2d> points1 =
+        keypointPositions(table.keypoints[index1]);
+    const std::vector<Eigen::Vector2d> points2 =
+        keypointPositions(table.keypoints[index2]);
+    TwoViewGeometry geometry = EstimateCalibratedTwoViewGeometry(
+        camera1, points1, camera2, points2, pairMatches.at(key),
+        geometryOptions);
+    if (geometry.config != TwoViewGeometry::CALIBRATED ||
+        !EstimateTwoViewGeometryPose(camera1, points1, camera2, points2,
+                                     &geometry) ||
+        geometry.inlier_matches.size() <
+            static_cast<size_t>(options.init_min_num_inliers) ||
+        geometry.tri_angle < DegToRad(options.init_min_tri_angle))
+      continue;
+    model.registerImage(index1, Rigid3d());
+    model.registerImage(index2, geometry.cam2_from_cam1);
+    model.triangulatePending(nullptr);
+    return true;
+  }
+  return false;
+}
+
+// Greedily registers the image that sees the most triangulated locators.
+// Images whose pose fails are retried once more points exist. When allowed
+// is not empty, only images flagged in it are registered.
+static void registerGreedily(TrackModel &model, int numImages,
+                             const IncrementalMapper::Options &options,
+                             const std::vector<char> &allowed,
+                             const std::function<bool()> &isCancelled,
+                             const std::function<void()> &onRegistered) {
+  std::unordered_set<int> failed;
+  while (!isCancelled()) {
+    int next = -1;
+    int nextCount = 0;
+    for (int i = 0; i < numImages; ++i) {
+      if ((!allowed.empty() && !allowed[i]) || model.isRegistered(i) ||
+          failed.count(i))
+        continue;
+      const int count = model.numVisiblePoints(i);
+      if (count > nextCount) {
+        next = i;
+        nextCount = count;
+      }
+    }
+    if (next < 0)
+      break;
+    if (!model.registerByPnP(next, options)) {
+      failed.insert(next);
       continue;
-    const auto &mat = P[idx];
-    double x = it.value().x();
-    double y = it.value().y();
-    rows.emplace_back(x * mat.row(2) - mat.row(0));
-    rows.emplace_back(y * mat.row(2) - mat.row(1));
-  }
-  if (rows.size() < 4)
-    return Eigen::Vector3d::Zero();
-  Eigen::MatrixXd A(rows.size(), 4);
-  for (int i = 0; i < rows.size(); ++i)
-    A.row(i) = rows[i];
-  Eigen::JacobiSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeFullV);
-  Eigen::Vector4d X = svd.matrixV().col(3);
-  X /= X(3);
-  return X.head<3>();
-}
-
-QMap<int, double> CameraCalibrator::getReprojectionErrorPerImage() const {
-  QMap<int, double> errors;
-  if (m_registeredIndices.isEmpty())
-    return errors;
-
-  QMap<int, Eigen::Matrix<double, 3, 4>> Pmats;
-  for (int idx : m_registeredIndices) {
-    if (idx >= m_intrinsics.size())
+    }
+    failed.clear();
+    model.triangulatePending(nullptr);
+    onRegistered();
+  }
+}
+
+bool CameraCalibrator::calibrateDirect() {
+  QElapsedTimer phase;
+  phase.start();
+  const IncrementalPipelineOptions options =
+      calibrationOptions(m_profile, m_numThreads);
+  const int numImages = m_imagePaths.size();
+  const TrackTable table =
+      buildTrackTable(m_pointData, numImages, &m_keypointSetIds);
+  const QVector<int> groups = cameraGroups();
+  TrackModel model(table, m_imageNames,
+                   groupCameras(groups, m_imageShapes, m_imageExif), groups);
+  Reconstruction &rec = model.reconstruction();
+  m_timings.preparation += lap(phase);
+  reportProgress(CalibrationProgress::Initializing, &rec);
+  if (!initializeFromBestPair(model, table, options.mapper)) {
+    m_timings.reconstruction += lap(phase);
+    return false;
+  }
+  reportProgress(CalibrationProgress::Registering, &rec);
+
+  registerGreedily(model, numImages, options.mapper, {},
+                   [this]() { return m_cancelRequested.load(); },
+                   [this, &rec]() {
+                     reportProgress(CalibrationProgress::Registering, &rec);
+                   });
+  m_timings.reconstruction += lap(phase);
+  if (m_cancelRequested || rec.NumRegImages() < 2)
+    return false;
+
+  // One bundle adjustment over all tracks. COLMAP's adjuster eliminates the
+  // points with a Schur complement solver, sparse once the problem is large.
+  BundleAdjustmentOptions baOptions = options.GlobalBundleAdjustment();
+  BundleAdjustmentMonitor baMonitor(
+      [this](int iteration) { return onBundleAdjustmentIteration(iteration); });
+  baOptions.solver_options.num_threads = options.num_threads;
+  baOptions.solver_options.callbacks.push_back(&baMonitor);
+  reportProgress(CalibrationProgress::Refining, &rec);
+  phase.restart();
+  const bool usable = solveBundleAdjustment(baOptions, globalConfig(rec), rec);
+  m_timings.bundleAdjustment += lap(phase);
+  if (m_cancelRequested || !usable)
+    return false;
+
+  storeSolution(model.shared());
+  m_timings.extraction += lap(phase);
+  return true;
+}
+
+namespace {
+
+// Similarity x' = scale * rotation * x + translation between the frames of
+// two models.
+struct Similarity {
+  double scale = 1.0;
+  Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+
+  Eigen::Vector3d apply(const Eigen::Vector3d &x) const {
+    return scale * (rotation * x) + translation;
+  }
+
+  // The camera frame is scaled along with the world, which leaves the
+  // projections unchanged.
+  Rigid3d apply(const Rigid3d &camFromWorld) const {
+    const Eigen::Matrix3d R =
+        camFromWorld.rotation.toRotationMatrix() * rotation.transpose();
+    Rigid3d result;
+    result.rotation = Eigen::Quaterniond(R).normalized();
+    result.translation = scale * camFromWorld.translation - R * translation;
+    return result;
+  }
+};
+
+} // namespace
+
+// Umeyama fit of the similarity taking from onto to. Pairs far above the
+// median residual are dropped and the fit is repeated without them.
+static bool fitSimilarity(const std::vector<Eigen::Vector3d> &from,
+                          const std::vector<Eigen::Vector3d> &to,
+                          Similarity *similarity) {
+  static const size_t kMinPoints = 4;
+  if (from.size() < kMinPoints)
+    return false;
+  auto fit = [&](const std::vector<size_t> &pairs) {
+    Eigen::Matrix3Xd src(3, pairs.size());
+    Eigen::Matrix3Xd dst(3, pairs.size());
+    for (size_t k = 0; k < pairs.size(); ++k) {
+      src.col(k) = from[pairs[k]];
+      dst.col(k) = to[pairs[k]];
+    }
+    const Eigen::Matrix4d T = Eigen::umeyama(src, dst, true);
+    Similarity result;
+    result.scale = T.col(0).head<3>().norm();
+    result.rotation = T.topLeftCorner<3, 3>() / result.scale;
+    result.translation = T.topRightCorner<3, 1>();
+    return result;
+  };
+
+  std::vector<size_t> all(from.size());
+  std::iota(all.begin(), all.end(), 0);
+  *similarity = fit(all);
+  std::vector<double> residuals(from.size());
+  for (size_t k = 0; k < from.size(); ++k)
+    residuals[k] = (similarity->apply(from[k]) - to[k]).norm();
+  std::vector<double> sorted = residuals;
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+                   sorted.end());
+  const double median = sorted[sorted.size() / 2];
+  std::vector<size_t> inliers;
+  for (size_t k = 0; k < from.size(); ++k) {
+    if (residuals[k] <= 3.0 * median)
+      inliers.push_back(k);
+  }
+  if (median > 0 && inliers.size() >= kMinPoints && inliers.size() < all.size())
+    *similarity = fit(inliers);
+  return std::isfinite(similarity->scale) && similarity->scale > 0;
+}
+
+// Brings the cluster models into the frame of the one with the most
+// registered images. The others follow in order of the number of points
+// they share with what has been merged so far, each through a similarity
+// fitted to those shared locator tracks. Images and points already merged
+// keep their first placement.
+static bool mergeClusterModels(
+    const std::vector<std::unique_ptr<TrackModel>> &clusters,
+    size_t numTracks, int numImages, TrackModel *merged) {
+  static const size_t kMinSharedTracks = 4;
+  std::vector<Eigen::Vector3d> points(numTracks);
+  std::vector<char> hasPoint(numTracks, 0);
+  std::unordered_set<camera_t> placedCameras;
+  auto absorb = [&](const TrackModel &cluster, const Similarity &similarity) {
+    const Reconstruction &rec = cluster.reconstruction();
+    for (int i = 0; i < numImages; ++i) {
+      if (!cluster.isRegistered(i) || merged->isRegistered(i))
+        continue;
+      if (placedCameras.insert(merged->cameraId(i)).second)
+        merged->setCamera(i, rec.Camera(cluster.cameraId(i)));
+      merged->registerImage(
+          i, similarity.apply(rec.Image(TrackModel::imageId(i)).CamFromWorld()));
+    }
+    for (size_t t = 0; t < numTracks; ++t) {
+      if (!hasPoint[t] && cluster.hasPoint(t)) {
+        points[t] = similarity.apply(cluster.point(t));
+        hasPoint[t] = 1;
+      }
+    }
+  };
+
+  std::vector<char> pending(clusters.size(), 0);
+  int first = -1;
+  for (size_t c = 0; c < clusters.size(); ++c) {
+    if (!clusters[c])
       continue;
-    const QMatrix3x3 &Kq = m_intrinsics[idx];
-    const QMatrix3x3 &Rq = m_rotations[idx];
-    QVector3D tq = m_translations[idx];
-    Eigen::Matrix3d K, Rwc;
-    for (int r = 0; r < 3; ++r) {
-      for (int c = 0; c < 3; ++c) {
-        K(r, c) = Kq(r, c);
-        Rwc(r, c) = Rq(r, c);
+    pending[c] = 1;
+    if (first < 0 || clusters[c]->reconstruction().NumRegImages() >
+                         clusters[first]->reconstruction().NumRegImages())
+      first = static_cast<int>(c);
+  }
+  if (first < 0)
+    return false;
+  absorb(*clusters[first], Similarity());
+  pending[first] = 0;
+
+  while (true) {
+    int next = -1;
+    size_t nextShared = 0;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+      if (!pending[c])
+        continue;
+      size_t shared = 0;
+      for (size_t t = 0; t < numTracks; ++t)
+        shared += hasPoint[t] && clusters[c]->hasPoint(t) ? 1 : 0;
+      if (shared > nextShared) {
+        next = static_cast<int>(c);
+        nextShared = shared;
+      }
+    }
+    if (next < 0 || nextShared < kMinSharedTracks)
+      break;
+    pending[next] = 0;
+    std::vector<Eigen::Vector3d> from;
+    std::vector<Eigen::Vector3d> to;
+    for (size_t t = 0; t < numTracks; ++t) {
+      if (hasPoint[t] && clusters[next]->hasPoint(t)) {
+        from.push_back(clusters[next]->point(t));
+        to.push_back(points[t]);
       }
     }
-    Eigen::Vector3d twc(tq.x(), tq.y(), tq.z());
-    Eigen::Matrix3d Rcw = Rwc.transpose();
-    Eigen::Vector3d tcw = -Rcw * twc;
-    Eigen::Matrix<double, 3, 4> P;
-    P.leftCols<3>() = Rcw;
-    P.col(3) = tcw;
-    P = K * P;
-    Pmats[idx] = P;
-  }
-
-  QMap<int, double> totals;
-  QMap<int, int> counts;
-  for (const auto &obs : m_pointData) {
-    Eigen::Vector3d X = triangulatePoint(obs, Pmats);
-    Eigen::Vector4d Xh;
-    Xh << X, 1.0;
-    for (auto it = obs.begin(); it != obs.end(); ++it) {
-      int idx = it.key();
-      if (!Pmats.contains(idx))
+    Similarity similarity;
+    if (fitSimilarity(from, to, &similarity))
+      absorb(*clusters[next], similarity);
+  }
+
+  for (size_t t = 0; t < numTracks; ++t) {
+    if (hasPoint[t])
+      merged->addPoint(t, points[t]);
+  }
+  merged->dropWeakPoints();
+  return merged->reconstruction().NumRegImages() >= 2;
+}
+
+bool CameraCalibrator::calibratePartitioned() {
+  QElapsedTimer phase;
+  phase.start();
+  const IncrementalPipelineOptions options =
+      calibrationOptions(m_profile, m_numThreads);
+  const int numImages = m_imagePaths.size();
+  const TrackTable table =
+      buildTrackTable(m_pointData, numImages, &m_keypointSetIds);
+  const QVector<int> groups = cameraGroups();
+  const std::vector<Camera> cameras =
+      groupCameras(groups, m_imageShapes, m_imageExif);
+
+  // Clusters come from normalized cuts of the co-visibility graph weighted
+  // by shared locators, like in COLMAP's hierarchical mapper. Neighbouring
+  // clusters overlap by a quarter of the cluster size so that their models
+  // share enough locators to be merged.
+  std::vector<std::pair<image_t, image_t>> imagePairs;
+  std::vector<int> numShared;
+  for (const auto &entry : buildPairMatches(table)) {
+    imagePairs.emplace_back(imageIdOf(static_cast<int>(entry.first >> 32)),
+                            imageIdOf(static_cast<int>(entry.first & 0xFFFFFFFFu)));
+    numShared.push_back(static_cast<int>(entry.second.size()));
+  }
+  if (imagePairs.empty())
+    return false;
+  SceneClustering::Options clusterOptions;
+  clusterOptions.is_hierarchical = true;
+  clusterOptions.branching = 2;
+  clusterOptions.leaf_max_num_images = m_partitionSize;
+  clusterOptions.image_overlap = std::max(2, m_partitionSize / 4);
+  SceneClustering clustering(clusterOptions);
+  clustering.Partition(imagePairs, numShared);
+  std::vector<std::vector<char>> members;
+  for (const SceneClustering::Cluster *cluster : clustering.GetLeafClusters()) {
+    std::vector<char> allowed(numImages, 0);
+    for (image_t id : cluster->image_ids) {
+      const int idx = indexOfImage(id, numImages);
+      if (idx >= 0)
+        allowed[idx] = 1;
+    }
+    members.push_back(std::move(allowed));
+  }
+  m_timings.preparation += lap(phase);
+
+  // Every cluster is solved like calibrateDirect() on a model of its own.
+  // The cores are split between the clusters that run at the same time.
+  reportProgress(CalibrationProgress::Initializing, nullptr);
+  const int numClusters = static_cast<int>(members.size());
+  const int numThreads = options.num_threads;
+  const int threadsPerCluster = std::max(
+      1, numThreads / std::max(1, std::min(numClusters, numThreads)));
+  auto isCancelled = [this]() { return m_cancelRequested.load(); };
+  std::vector<std::unique_ptr<TrackModel>> clusters(numClusters);
+  parallelFor(numClusters, [&](int c) {
+    auto model =
+        std::make_unique<TrackModel>(table, m_imageNames, cameras, groups);
+    if (!initializeFromBestPair(*model, table, options.mapper, members[c]))
+      return;
+    registerGreedily(*model, numImages, options.mapper, members[c],
+                     isCancelled, []() {});
+    Reconstruction &rec = model->reconstruction();
+    if (m_cancelRequested || rec.NumRegImages() < 2)
+      return;
+    BundleAdjustmentOptions baOptions = options.GlobalBundleAdjustment();
+    BundleAdjustmentMonitor cancelMonitor(
+        [this](int) { return !m_cancelRequested; });
+    baOptions.solver_options.num_threads = threadsPerCluster;
+    baOptions.solver_options.callbacks.push_back(&cancelMonitor);
+    // A cluster whose adjustment failed is left out of the merge.
+    if (solveBundleAdjustment(baOptions, globalConfig(rec), rec))
+      clusters[c] = std::move(model);
+  }, 1, numThreads);
+
+  TrackModel merged(table, m_imageNames, cameras, groups);
+  Reconstruction &rec = merged.reconstruction();
+  if (m_cancelRequested ||
+      !mergeClusterModels(clusters, table.tracks.size(), numImages, &merged)) {
+    m_timings.reconstruction += lap(phase);
+    return false;
+  }
+  clusters.clear();
+  reportProgress(CalibrationProgress::Registering, &rec);
+
+  // Images that no cluster placed, or whose cluster shared too little with
+  // the others, get another chance against the merged model.
+  merged.triangulatePending(nullptr);
+  registerGreedily(merged, numImages, options.mapper, {}, isCancelled,
+                   [this, &rec]() {
+                     reportProgress(CalibrationProgress::Registering, &rec);
+                   });
+  m_timings.reconstruction += lap(phase);
+  if (m_cancelRequested)
+    return false;
+
+  BundleAdjustmentOptions baOptions = options.GlobalBundleAdjustment();
+  BundleAdjustmentMonitor baMonitor(
+      [this](int iteration) { return onBundleAdjustmentIteration(iteration); });
+  baOptions.solver_options.num_threads = options.num_threads;
+  baOptions.solver_options.callbacks.push_back(&baMonitor);
+  reportProgress(CalibrationProgress::Refining, &rec);
+  const bool usable = solveBundleAdjustment(baOptions, globalConfig(rec), rec);
+  m_timings.bundleAdjustment += lap(phase);
+  if (m_cancelRequested || !usable)
+    return false;
+
+  storeSolution(merged.shared());
+  m_timings.extraction += lap(phase);
+  return true;
+}
+
+void CameraCalibrator::storeSolution(
+    const std::shared_ptr<Reconstruction> &rec) {
+  m_workspacePath.clear();
+  if (m_keepWorkspace) {
+    // A directory with a unique name per kept model, so concurrent
+    // calibrations never write into each other's output.
+    QTemporaryDir dir(
+        QDir(m_workspaceRoot.isEmpty() ? QDir::tempPath() : m_workspaceRoot)
+            .filePath("amcpp_calib_XXXXXX"));
+    if (dir.isValid()) {
+      dir.setAutoRemove(false);
+      const QString sparse = QDir(dir.path()).filePath("sparse");
+      QDir().mkpath(sparse);
+      rec->Write(sparse.toStdString());
+      m_workspacePath = dir.path();
+    }
+  }
+
+  const int numImages = m_imagePaths.size();
+  m_cameras.assign(numImages, CameraSolution());
+  m_registeredIndices.clear();
+  for (image_t imgId : rec->RegImageIds()) {
+    const int idx = indexOfImage(imgId, numImages);
+    if (idx < 0)
+      continue;
+    const Image &img = rec->Image(imgId);
+    const Camera &cam = rec->Camera(img.CameraId());
+    CameraSolution &solution = m_cameras[idx];
+    if (cam.model_id == CameraModelId::kSimplePinhole &&
+        cam.params.size() == 3)
+      std::copy(cam.params.begin(), cam.params.end(), solution.intrinsics);
+    const Rigid3d worldFromCam = Inverse(img.CamFromWorld());
+    const Eigen::Quaterniond &q = worldFromCam.rotation;
+    solution.rotation[0] = q.w();
+    solution.rotation[1] = q.x();
+    solution.rotation[2] = q.y();
+    solution.rotation[3] = q.z();
+    std::copy(worldFromCam.translation.data(),
+              worldFromCam.translation.data() + 3, solution.translation);
+    solution.valid = true;
+    m_registeredIndices.append(idx);
+  }
+
+  // Remember where every locator ended up. The mapper may split a track,
+  // in which case the longest part wins.
+  auto solution = std::make_shared<Solution>();
+  solution->reconstruction = rec;
+  solution->imagePaths = m_imagePaths;
+  solution->pointData = m_pointData;
+  std::unordered_map<int, size_t> trackLength;
+  for (const auto &entry : rec->Points3D()) {
+    const Point3D &point = entry.second;
+    for (const TrackElement &el : point.track.Elements()) {
+      const int idx = indexOfImage(el.image_id, numImages);
+      if (idx < 0 || el.point2D_idx >= static_cast<point2D_t>(
+                                           m_keypointSetIds[idx].size()))
         continue;
-      const auto &P = Pmats[idx];
-      Eigen::Vector3d proj = P * Xh;
-      proj /= proj(2);
-      QPointF pt = it.value();
-      double err = std::hypot(pt.x() - proj(0), pt.y() - proj(1));
-      totals[idx] += err;
-      counts[idx] += 1;
-    }
-  }
-  for (int idx : Pmats.keys()) {
-    if (counts[idx])
-      errors[idx] = totals[idx] / counts[idx];
-    else
-      errors[idx] = std::numeric_limits<double>::infinity();
-  }
-  return errors;
+      const int setId = m_keypointSetIds[idx][el.point2D_idx];
+      if (point.track.Length() > trackLength[setId]) {
+        trackLength[setId] = point.track.Length();
+        solution->setPoints[setId] = point.xyz;
+      }
+      break;
+    }
+  }
+  m_solution = solution;
+}
+
+ProjectionTable CameraCalibrator::getProjections() const {
+  ProjectionTable table;
+  for (int idx = 0; idx < cameraCount(); ++idx) {
+    const CameraSolution &camera = m_cameras[idx];
+    if (camera.valid)
+      table.set(idx, makeProjectionMatrix(camera.intrinsicMatrix(),
+                                          camera.rotationMatrix(),
+                                          camera.center()));
+  }
+  return table;
+}
+
+ReprojectionErrors CameraCalibrator::getReprojectionErrors() const {
+  return computeReprojectionErrors(m_pointData, getProjections(),
+                                   m_imagePaths.size(), m_rejectedPoints,
+                                   m_numThreads);
 }
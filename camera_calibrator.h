@@ -2,35 +2,219 @@
 #define CAMERA_CALIBRATOR_H
 
 #include <QMap>
-#include <QMatrix3x3>
 #include <QPointF>
+#include <QSize>
 #include <QStringList>
 #include <QVector3D>
 #include <QVector>
 
+#include "exif_reader.h"
+#include "outlier_detection.h"
+#include "reprojection_errors.h"
+
+#include <Eigen/Core>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace colmap {
+class Reconstruction;
+}
+
+// Snapshot passed to the progress callback. Reported from the thread that
+// runs calibrate().
+struct CalibrationProgress {
+  enum Stage { Preparing, Initializing, Registering, Refining, Finished };
+
+  Stage stage = Preparing;
+  int totalImages = 0;
+  int baIterations = 0;
+  // Project indices and camera centres of the images registered so far.
+  QVector<int> registeredIndices;
+  QVector<QVector3D> cameraCenters;
+};
+
+// Wall time in milliseconds spent in each phase of the last calibrate() or
+// refine(). Phases that repeat across outlier passes are summed; the
+// incremental mapper's own bundle adjustments count as reconstruction.
+struct CalibrationTimings {
+  double outlierRejection = 0;
+  double preparation = 0;
+  double reconstruction = 0;
+  double bundleAdjustment = 0;
+  double extraction = 0;
+  double total = 0;
+};
+
+// Solved camera of one image in double precision. Intrinsics are the simple
+// pinhole focal length and principal point in pixels; the pose is camera to
+// world, a unit quaternion (w, x, y, z) and the camera centre.
+struct CameraSolution {
+  double intrinsics[3] = {0, 0, 0};
+  double rotation[4] = {1, 0, 0, 0};
+  double translation[3] = {0, 0, 0};
+  bool valid = false;
+
+  Eigen::Matrix3d intrinsicMatrix() const;
+  Eigen::Matrix3d rotationMatrix() const;
+  Eigen::Vector3d center() const {
+    return Eigen::Vector3d(translation[0], translation[1], translation[2]);
+  }
+};
+
+// Named trade-offs between turnaround time and accuracy. Each maps to the
+// mapper, triangulation and bundle adjustment options of a solve.
+enum class CalibrationProfile { InteractiveFast, Balanced, FinalAccurate };
+
+// "interactive-fast", "balanced" and "final-accurate", as stored in projects.
+QString calibrationProfileName(CalibrationProfile profile);
+bool parseCalibrationProfile(const QString &name, CalibrationProfile *profile);
+
 class CameraCalibrator {
 public:
+  using ProgressCallback = std::function<void(const CalibrationProgress &)>;
+
+  // Reads the size and EXIF metadata of every image. A focal length from
+  // EXIF seeds the camera instead of the 1.2 x image size guess.
   bool loadImages(const QStringList &imagePaths);
+  // Like loadImages() for callers that already know the image sizes, e.g.
+  // from an archive or a synthetic scene. Nothing is read from disk; exif
+  // optionally holds metadata the caller parsed itself, one per image.
+  bool loadImageSizes(const QStringList &imagePaths,
+                      const QVector<QSize> &sizes,
+                      const QVector<ExifInfo> &exif = QVector<ExifInfo>());
   bool loadPointData(const QMap<int, QMap<int, QPointF>> &pointData);
+
+  // Images in the same camera group share one set of intrinsics, so a shot
+  // from a single lens solves one focal length instead of one per frame.
+  // Entries >= 0 assign a group by hand; images without one are grouped by
+  // image size and EXIF body, lens and focal length. cameraGroups() returns
+  // the resolved 0-based group per image.
+  void setCameraGroups(const QVector<int> &groups);
+  QVector<int> cameraGroups() const;
+  // Direct builds the model straight from the locator tracks: the pair
+  // sharing the most locators is initialized from its relative pose, the
+  // other images are registered by PnP and one bundle adjustment refines
+  // everything. It falls back to the incremental mapper when that fails.
+  // Partitioned is meant for very large image sets: images are clustered on
+  // the locator co-visibility graph, every cluster is solved like Direct in
+  // parallel, and the cluster models are merged on their shared locators
+  // before one global bundle adjustment. Sets no larger than the partition
+  // size are solved with Direct.
+  enum class Solver { Direct, Incremental, Partitioned };
+  void setSolver(Solver solver) { m_solver = solver; }
+  Solver solver() const { return m_solver; }
+  void setPartitionSize(int maxImages);
+  int partitionSize() const { return m_partitionSize; }
+
+  // Number of incremental mapper runs started in parallel by calibrate().
+  // Each works on its own in-memory database from a different initial pair
+  // and seed; the model with the most registered images and then the lowest
+  // mean reprojection error is kept. Only the first run reports progress.
+  void setMultiStartRuns(int runs);
+  int multiStartRuns() const { return m_multiStartRuns; }
+
+  void setProfile(CalibrationProfile profile) { m_profile = profile; }
+  CalibrationProfile profile() const { return m_profile; }
+
+  // Threads used by the mapper, bundle adjustment and the parallel pair,
+  // outlier and error passes; <= 0 leaves the choice to the profile. Lower
+  // it when several calibrations run side by side.
+  void setNumThreads(int threads) { m_numThreads = threads; }
+  int numThreads() const { return m_numThreads; }
+
   bool calibrate();
+  // Recalibrates starting from the last solution: poses and intrinsics are
+  // reused, only new or edited locators are triangulated and new images are
+  // registered by PnP before a local or global bundle adjustment. Falls
+  // back to calibrate() when there is no previous solution.
+  bool refine();
+  bool hasSolution() const { return m_solution != nullptr; }
+
+  // Outlier rejection is off by default. When on, calibrate() and refine()
+  // first drop clicks that fail the pairwise epipolar check, then drop
+  // clicks that disagree with the solved cameras and refine again. A pass
+  // that would leave too few locators or whose refinement fails is undone,
+  // keeping the solution found before it. The point data is cleaned in
+  // place; outliers() lists everything removed by the last run and
+  // getReprojectionErrors() still measures those clicks, marked as rejected.
+  void setRejectOutliers(bool reject);
+  void setOutlierThreshold(double pixels);
+  QVector<LocatorObservation> outliers() const { return m_outliers; }
 
-  QVector<QMatrix3x3> getIntrinsics() const { return m_intrinsics; }
-  QVector<QMatrix3x3> getRotations() const { return m_rotations; }
-  QVector<QVector3D> getTranslations() const { return m_translations; }
-  QVector<int> getRegisteredIndices() const { return m_registeredIndices; }
-  QMap<int, double> getReprojectionErrorPerImage() const;
+  // Camera table of the last solution with one entry per image, in image
+  // order. Entries of images that were not registered are not valid.
+  const std::vector<CameraSolution> &cameras() const { return m_cameras; }
+  const CameraSolution *cameraData() const { return m_cameras.data(); }
+  int cameraCount() const { return static_cast<int>(m_cameras.size()); }
+  const QVector<int> &getRegisteredIndices() const {
+    return m_registeredIndices;
+  }
+  // Projection matrices of the registered images, by image index.
+  ProjectionTable getProjections() const;
+  ReprojectionErrors getReprojectionErrors() const;
+  CalibrationTimings timings() const { return m_timings; }
+
+  // calibrate() may run on a worker thread. The callback is invoked on that
+  // thread; requestCancel() may be called from any thread and makes
+  // calibrate() return false as soon as the mapper reaches a safe point.
+  void setProgressCallback(ProgressCallback callback);
+  void requestCancel();
+  bool wasCancelled() const { return m_cancelRequested; }
+
+  // Calibration runs entirely in memory. When keepWorkspace is set, each run
+  // writes its COLMAP model to a fresh workspace under the root and leaves
+  // it on disk for inspection; workspacePath() names the last one.
+  void setWorkspaceRoot(const QString &root);
+  void setKeepWorkspace(bool keep);
+  QString workspacePath() const { return m_workspacePath; }
 
 private:
-  bool populateDatabase(const QString &dbPath);
+  struct Solution;
+
+  bool solve(bool warmStart);
+  // Moves the clicks out of the point data into the rejected set.
+  void rejectObservations(const QVector<LocatorObservation> &observations);
+  bool solveFromScratch();
+  bool solveWarm();
+  bool calibrateDirect();
+  bool calibratePartitioned();
+  bool onBundleAdjustmentIteration(int iteration);
+  void reportProgress(CalibrationProgress::Stage stage,
+                      const colmap::Reconstruction *rec);
+  void storeSolution(const std::shared_ptr<colmap::Reconstruction> &rec);
 
   QStringList m_imagePaths;
+  // Unique COLMAP image name of every image.
+  QStringList m_imageNames;
   QVector<QPair<int, int>> m_imageShapes;
+  QVector<ExifInfo> m_imageExif;
+  QVector<int> m_userCameraGroups;
   QMap<int, QMap<int, QPointF>> m_pointData;
-  QVector<QMatrix3x3> m_intrinsics;
-  QVector<QMatrix3x3> m_rotations;
-  QVector<QVector3D> m_translations;
+  std::vector<CameraSolution> m_cameras;
   QVector<int> m_registeredIndices;
-  QMap<int, QMap<int, int>> m_keypointMaps;
+  QString m_workspaceRoot;
+  QString m_workspacePath;
+  bool m_keepWorkspace = false;
+  Solver m_solver = Solver::Direct;
+  int m_multiStartRuns = 1;
+  int m_partitionSize = 200;
+  int m_numThreads = -1;
+  CalibrationProfile m_profile = CalibrationProfile::Balanced;
+  bool m_rejectOutliers = false;
+  double m_outlierThreshold = 8.0;
+  QVector<LocatorObservation> m_outliers;
+  // The clicks of m_outliers, by locator and image.
+  QMap<int, QMap<int, QPointF>> m_rejectedPoints;
+  ProgressCallback m_progressCallback;
+  std::atomic<bool> m_cancelRequested{false};
+  CalibrationProgress m_progress;
+  CalibrationTimings m_timings;
+  std::shared_ptr<Solution> m_solution;
+  // Locator id of every keypoint written for each image, by keypoint index.
+  QVector<QVector<int>> m_keypointSetIds;
 };
 
 #endif // CAMERA_CALIBRATOR_H
@@ -0,0 +1,309 @@
+// Headless batch calibration of .ams projects:
+//
+//   amcalibrate [--jobs N] [--solver direct|incremental|partitioned] a.ams ...
+//   amcalibrate --list projects.txt
+//
+// Every project is loaded with its images from the archive, calibrated and
+// written back with the solved cameras and locator errors.
+
+#include "amutilities.h"
+#include "camera_calibrator.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtMath>
+
+struct JobOptions {
+    CameraCalibrator::Solver solver = CameraCalibrator::Solver::Partitioned;
+    int partitionSize = 200;
+    // Overrides the profile stored in the projects when set.
+    bool overrideProfile = false;
+    CalibrationProfile profile = CalibrationProfile::Balanced;
+    int threads = 1;
+    bool write = true;
+    bool rejectOutliers = false;
+};
+
+struct JobResult {
+    QString path;
+    QString profile;
+    bool ok = false;
+    QString message;
+    int registered = 0;
+    int images = 0;
+    int rejected = 0;
+    double meanError = 0.0;
+    double loadMs = 0.0;
+    double saveMs = 0.0;
+    CalibrationTimings timings;
+};
+
+// Same rules as CameraCalibrator::loadImages(): the size from the header,
+// rotated like a decoded QImage would be, or a full decode as the fallback.
+static QSize imageSize(QIODevice *device)
+{
+    if (!device->open(QIODevice::ReadOnly))
+        return QSize();
+    QImageReader reader(device);
+    QSize size = reader.size();
+    if (!size.isValid()) {
+        device->seek(0);
+        return QImageReader(device).read().size();
+    }
+    if (reader.autoTransform()
+        && reader.transformation().testFlag(QImageIOHandler::TransformationRotate90))
+        size.transpose();
+    return size;
+}
+
+static double elapsedMs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+static JobResult calibrateProject(const QString &path, const JobOptions &options)
+{
+    JobResult result;
+    result.path = path;
+    QElapsedTimer timer;
+    timer.start();
+
+    QStringList imagePaths;
+    QList<LocatorData> locators;
+    QList<CameraData> cameras;
+    QList<LoadedImage> archived;
+    QString profileName;
+    if (!loadSceneAms(path, imagePaths, locators, cameras, archived, &profileName)) {
+        result.message = QStringLiteral("cannot read project");
+        return result;
+    }
+    result.images = imagePaths.size();
+
+    // Archived images are stored by file name. Images missing from the
+    // archive are read from their original path when it exists.
+    QHash<QString, int> archivedByName;
+    for (int i = 0; i < archived.size(); ++i)
+        archivedByName.insert(archived[i].name, i);
+    QVector<QSize> sizes;
+    QVector<ExifInfo> exif;
+    for (const QString &imagePath : imagePaths) {
+        const int a = archivedByName.value(QFileInfo(imagePath).fileName(), -1);
+        QSize size;
+        if (a >= 0) {
+            QBuffer buffer(&archived[a].data);
+            size = imageSize(&buffer);
+            exif.append(readExif(archived[a].data));
+        } else {
+            QFile file(imagePath);
+            size = imageSize(&file);
+            exif.append(cachedExif(imagePath));
+        }
+        if (!size.isValid()) {
+            result.message = QStringLiteral("no image data for %1").arg(imagePath);
+            return result;
+        }
+        sizes.append(size);
+    }
+
+    QMap<int, QMap<int, QPointF>> pointData;
+    for (int setId = 0; setId < locators.size(); ++setId) {
+        QMap<int, QPointF> map;
+        for (auto it = locators[setId].positions.cbegin(); it != locators[setId].positions.cend(); ++it) {
+            const int idx = it.key();
+            if (idx < 0 || idx >= sizes.size())
+                continue;
+            map.insert(idx, QPointF(it.value().x() * sizes[idx].width(),
+                                    it.value().y() * sizes[idx].height()));
+        }
+        if (!map.isEmpty())
+            pointData.insert(setId, map);
+    }
+    result.loadMs = elapsedMs(timer);
+
+    CameraCalibrator calibrator;
+    calibrator.setSolver(options.solver);
+    calibrator.setPartitionSize(options.partitionSize);
+    CalibrationProfile profile = CalibrationProfile::Balanced;
+    if (options.overrideProfile)
+        profile = options.profile;
+    else
+        parseCalibrationProfile(profileName, &profile);
+    calibrator.setProfile(profile);
+    result.profile = calibrationProfileName(profile);
+    calibrator.setNumThreads(options.threads);
+    calibrator.setRejectOutliers(options.rejectOutliers);
+    calibrator.loadImageSizes(imagePaths, sizes, exif);
+    calibrator.loadPointData(pointData);
+    result.ok = calibrator.calibrate();
+    result.timings = calibrator.timings();
+    if (!result.ok) {
+        result.message = QStringLiteral("calibration failed");
+        return result;
+    }
+
+    result.registered = calibrator.getRegisteredIndices().size();
+    result.rejected = calibrator.outliers().size();
+    cameras.clear();
+    const CameraSolution *solved = calibrator.cameraData();
+    for (int idx = 0; idx < calibrator.cameraCount(); ++idx) {
+        if (!solved[idx].valid)
+            continue;
+        CameraData camera;
+        camera.image = idx;
+        camera.intrinsics = solved[idx].intrinsicMatrix();
+        camera.rotation = solved[idx].rotationMatrix();
+        camera.translation = solved[idx].center();
+        cameras.append(camera);
+    }
+
+    const ReprojectionErrors errors = calibrator.getReprojectionErrors();
+    for (int setId = 0; setId < errors.perLocator.size() && setId < locators.size(); ++setId) {
+        if (qIsFinite(errors.perLocator[setId]))
+            locators[setId].error = static_cast<float>(errors.perLocator[setId]);
+    }
+    int measured = 0;
+    for (double e : errors.perImage) {
+        if (qIsFinite(e)) {
+            result.meanError += e;
+            ++measured;
+        }
+    }
+    if (measured > 0)
+        result.meanError /= measured;
+
+    if (options.write) {
+        timer.restart();
+        if (!saveScene(path, imagePaths, locators, cameras, archived, profileName)) {
+            result.ok = false;
+            result.message = QStringLiteral("cannot write project");
+        }
+        result.saveMs = elapsedMs(timer);
+    }
+    return result;
+}
+
+static QString formatResult(const JobResult &r)
+{
+    const CalibrationTimings &t = r.timings;
+    QString line = QStringLiteral("%1 [%2]: ").arg(r.path, r.profile);
+    if (!r.ok)
+        line += QStringLiteral("FAILED (%1), ").arg(r.message);
+    else
+        line += QStringLiteral("%1/%2 images, %3 px, %4 clicks rejected, ")
+                    .arg(r.registered).arg(r.images).arg(r.meanError, 0, 'f', 2).arg(r.rejected);
+    line += QStringLiteral("load %1 ms, outliers %2 ms, prepare %3 ms, reconstruct %4 ms, "
+                           "bundle adjustment %5 ms, extract %6 ms, calibrate %7 ms, save %8 ms")
+                .arg(r.loadMs, 0, 'f', 1)
+                .arg(t.outlierRejection, 0, 'f', 1)
+                .arg(t.preparation, 0, 'f', 1)
+                .arg(t.reconstruction, 0, 'f', 1)
+                .arg(t.bundleAdjustment, 0, 'f', 1)
+                .arg(t.extraction, 0, 'f', 1)
+                .arg(t.total, 0, 'f', 1)
+                .arg(r.saveMs, 0, 'f', 1);
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Calibrates .ams projects without a GUI.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("projects", "Projects to calibrate.", "[project.ams...]");
+    QCommandLineOption listOption("list", "Read project paths from a file, one per line.", "file");
+    QCommandLineOption jobsOption("jobs", "Projects calibrated at the same time.", "n");
+    QCommandLineOption solverOption("solver", "direct, incremental or partitioned.", "name",
+                                    "partitioned");
+    QCommandLineOption partitionOption("partition-size",
+                                       "Largest cluster of the partitioned solver.", "images", "200");
+    QCommandLineOption profileOption("profile",
+                                     "interactive-fast, balanced or final-accurate; "
+                                     "defaults to the profile stored in each project.",
+                                     "name");
+    QCommandLineOption dryRunOption("dry-run", "Calibrate without writing the projects back.");
+    QCommandLineOption rejectOption("reject-outliers",
+                                    "Drop clicks that disagree with the other views and report them.");
+    parser.addOptions({listOption, jobsOption, solverOption, partitionOption, profileOption,
+                       dryRunOption, rejectOption});
+    parser.process(app);
+
+    QStringList projects = parser.positionalArguments();
+    if (parser.isSet(listOption)) {
+        QFile list(parser.value(listOption));
+        if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream(stderr) << "Cannot read " << list.fileName() << Qt::endl;
+            return 1;
+        }
+        QTextStream in(&list);
+        while (!in.atEnd()) {
+            const QString line = in.readLine().trimmed();
+            if (!line.isEmpty())
+                projects << line;
+        }
+    }
+    if (projects.isEmpty())
+        parser.showHelp(1);
+
+    JobOptions options;
+    const QString solver = parser.value(solverOption);
+    if (solver == "direct")
+        options.solver = CameraCalibrator::Solver::Direct;
+    else if (solver == "incremental")
+        options.solver = CameraCalibrator::Solver::Incremental;
+    else if (solver != "partitioned")
+        parser.showHelp(1);
+    options.partitionSize = parser.value(partitionOption).toInt();
+    if (parser.isSet(profileOption)) {
+        options.overrideProfile = true;
+        if (!parseCalibrationProfile(parser.value(profileOption), &options.profile))
+            parser.showHelp(1);
+    }
+    options.write = !parser.isSet(dryRunOption);
+    options.rejectOutliers = parser.isSet(rejectOption);
+
+    // By default every job gets about four cores; the cores are split evenly
+    // between the jobs that run at once.
+    const int cores = qMax(1, QThread::idealThreadCount());
+    int jobs = parser.isSet(jobsOption) ? parser.value(jobsOption).toInt() : cores / 4;
+    jobs = qBound(1, jobs, int(projects.size()));
+    options.threads = qMax(1, cores / jobs);
+
+    QTextStream out(stdout);
+    out << "Calibrating " << projects.size() << " projects, " << jobs << " at a time, "
+        << options.threads << " threads each" << Qt::endl;
+
+    QElapsedTimer wall;
+    wall.start();
+    QMutex outputMutex;
+    int failed = 0;
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    for (const QString &project : projects) {
+        pool.start([&, project]() {
+            const JobResult result = calibrateProject(project, options);
+            QMutexLocker lock(&outputMutex);
+            if (!result.ok)
+                ++failed;
+            out << formatResult(result) << Qt::endl;
+        });
+    }
+    pool.waitForDone();
+
+    out << QStringLiteral("%1 of %2 projects calibrated in %3 s")
+               .arg(projects.size() - failed)
+               .arg(projects.size())
+               .arg(elapsedMs(wall) / 1000.0, 0, 'f', 1)
+        << Qt::endl;
+    return failed == 0 ? 0 : 2;
+}
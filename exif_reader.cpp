@@ -0,0 +1,356 @@
+#include "exif_reader.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+double ExifInfo::focalLengthPixels(int width, int height) const {
+  const double maxSide = std::max(width, height);
+  double f = 0;
+  if (focalLength > 0 && focalPlanePixelsPerMm > 0) {
+    const int sensorWidth = orientation >= 5 ? height : width;
+    const double scale =
+        pixelWidth > 0 ? double(sensorWidth) / pixelWidth : 1.0;
+    f = focalLength * focalPlanePixelsPerMm * scale;
+  } else if (focalLength35mm > 0) {
+    // The 35 mm equivalent is defined over the image diagonal.
+    f = focalLength35mm / 43.2666 * std::hypot(width, height);
+  }
+  return f >= 0.2 * maxSide && f <= 20.0 * maxSide ? f : 0.0;
+}
+
+QString ExifInfo::cameraKey() const {
+  if (make.isEmpty() && model.isEmpty() && lens.isEmpty() &&
+      focalLength <= 0 && focalLength35mm <= 0)
+    return QString();
+  return QStringLiteral("%1|%2|%3|%4|%5")
+      .arg(make, model, lens)
+      .arg(focalLength, 0, 'f', 1)
+      .arg(focalLength35mm, 0, 'f', 0);
+}
+
+namespace {
+
+// Bounds-checked reader of a TIFF structure, the layout of EXIF data.
+class TiffReader {
+public:
+  explicit TiffReader(const QByteArray &data) : m_data(data) {}
+
+  bool open() {
+    if (m_data.size() < 8)
+      return false;
+    if (m_data.startsWith("II"))
+      m_bigEndian = false;
+    else if (m_data.startsWith("MM"))
+      m_bigEndian = true;
+    else
+      return false;
+    return u16(2) == 42;
+  }
+
+  uint32_t firstIfd() const { return u32(4); }
+
+  // Calls fn(tag, type, count, valueOffset) for every entry of the IFD.
+  template <typename Fn> void forEachEntry(uint32_t ifd, Fn &&fn) const {
+    if (!inRange(ifd, 2))
+      return;
+    const int count = u16(ifd);
+    for (int e = 0; e < count; ++e) {
+      const uint32_t entry = ifd + 2 + 12 * e;
+      if (!inRange(entry, 12))
+        return;
+      const uint16_t type = u16(entry + 2);
+      const uint32_t n = u32(entry + 4);
+      const uint32_t bytes = typeSize(type) * n;
+      fn(u16(entry), type, n, bytes <= 4 ? entry + 8 : u32(entry + 8));
+    }
+  }
+
+  double number(uint16_t type, uint32_t offset) const {
+    switch (type) {
+    case 3:
+      return inRange(offset, 2) ? u16(offset) : 0.0;
+    case 4:
+      return inRange(offset, 4) ? u32(offset) : 0.0;
+    case 5:
+    case 10: {
+      if (!inRange(offset, 8))
+        return 0.0;
+      const double den = type == 5 ? double(u32(offset + 4))
+                                   : double(int32_t(u32(offset + 4)));
+      const double num =
+          type == 5 ? double(u32(offset)) : double(int32_t(u32(offset)));
+      return den != 0 ? num / den : 0.0;
+    }
+    default:
+      return 0.0;
+    }
+  }
+
+  QString text(uint32_t count, uint32_t offset) const {
+    if (!inRange(offset, count))
+      return QString();
+    QByteArray bytes = m_data.mid(int(offset), int(count));
+    const int end = bytes.indexOf('\0');
+    if (end >= 0)
+      bytes.truncate(end);
+    return QString::fromLatin1(bytes).trimmed();
+  }
+
+private:
+  static uint32_t typeSize(uint16_t type) {
+    switch (type) {
+    case 3:
+    case 8:
+      return 2;
+    case 4:
+    case 9:
+    case 11:
+      return 4;
+    case 5:
+    case 10:
+    case 12:
+      return 8;
+    default:
+      return 1;
+    }
+  }
+  bool inRange(uint32_t offset, uint32_t size) const {
+    return offset <= uint32_t(m_data.size()) &&
+           size <= uint32_t(m_data.size()) - offset;
+  }
+  uint8_t byte(uint32_t i) const { return uint8_t(m_data[int(i)]); }
+  uint16_t u16(uint32_t i) const {
+    return m_bigEndian ? uint16_t(byte(i) << 8 | byte(i + 1))
+                       : uint16_t(byte(i + 1) << 8 | byte(i));
+  }
+  uint32_t u32(uint32_t i) const {
+    return m_bigEndian ? uint32_t(u16(i)) << 16 | u16(i + 2)
+                       : uint32_t(u16(i + 2)) << 16 | u16(i);
+  }
+
+  const QByteArray &m_data;
+  bool m_bigEndian = false;
+};
+
+// Millimetres per FocalPlaneResolutionUnit: inch, cm, mm, um.
+double resolutionUnitMm(int unit) {
+  switch (unit) {
+  case 3:
+    return 10.0;
+  case 4:
+    return 1.0;
+  case 5:
+    return 0.001;
+  default:
+    return 25.4;
+  }
+}
+
+void parseTiff(const QByteArray &data, ExifInfo *info) {
+  TiffReader tiff(data);
+  if (!tiff.open())
+    return;
+  uint32_t exifIfd = 0;
+  tiff.forEachEntry(tiff.firstIfd(), [&](uint16_t tag, uint16_t type,
+                                         uint32_t count, uint32_t offset) {
+    switch (tag) {
+    case 0x010F:
+      info->make = tiff.text(count, offset);
+      break;
+    case 0x0110:
+      info->model = tiff.text(count, offset);
+      break;
+    case 0x0112:
+      info->orientation = int(tiff.number(type, offset));
+      break;
+    case 0x8769:
+      exifIfd = uint32_t(tiff.number(type, offset));
+      break;
+    }
+  });
+  if (exifIfd == 0)
+    return;
+
+  double planeResolution = 0;
+  int planeUnit = 2;
+  tiff.forEachEntry(exifIfd, [&](uint16_t tag, uint16_t type, uint32_t count,
+                                 uint32_t offset) {
+    switch (tag) {
+    case 0x920A:
+      info->focalLength = tiff.number(type, offset);
+      break;
+    case 0xA405:
+      info->focalLength35mm = tiff.number(type, offset);
+      break;
+    case 0xA20E:
+      planeResolution = tiff.number(type, offset);
+      break;
+    case 0xA210:
+      planeUnit = int(tiff.number(type, offset));
+      break;
+    case 0xA002:
+      info->pixelWidth = int(tiff.number(type, offset));
+      break;
+    case 0xA003:
+      info->pixelHeight = int(tiff.number(type, offset));
+      break;
+    case 0xA434:
+      info->lens = tiff.text(count, offset);
+      break;
+    }
+  });
+  if (planeResolution > 0)
+    info->focalPlanePixelsPerMm =
+        planeResolution / resolutionUnitMm(planeUnit);
+}
+
+// Value of an XMP property written either as name="value" or as
+// <name>value</name>.
+QString xmpValue(const QByteArray &xmp, const char *name) {
+  const QByteArray key(name);
+  int start = xmp.indexOf(key + "=\"");
+  if (start >= 0) {
+    start += key.size() + 2;
+    const int end = xmp.indexOf('"', start);
+    return end < 0 ? QString()
+                   : QString::fromUtf8(xmp.mid(start, end - start)).trimmed();
+  }
+  start = xmp.indexOf("<" + key + ">");
+  if (start < 0)
+    return QString();
+  start += key.size() + 2;
+  const int end = xmp.indexOf("</" + key + ">", start);
+  if (end < 0)
+    return QString();
+  QString value = QString::fromUtf8(xmp.mid(start, end - start)).trimmed();
+  // Alternatives and sequences wrap the value in <rdf:li> elements.
+  const int li = value.indexOf(QLatin1String("<rdf:li"));
+  if (li >= 0) {
+    const int from = value.indexOf(QLatin1Char('>'), li) + 1;
+    value = value.mid(from, value.indexOf(QLatin1Char('<'), from) - from);
+  }
+  return value.trimmed();
+}
+
+double xmpNumber(const QByteArray &xmp, const char *name) {
+  const QString value = xmpValue(xmp, name);
+  const int slash = value.indexOf(QLatin1Char('/'));
+  if (slash < 0)
+    return value.toDouble();
+  const double den = value.mid(slash + 1).toDouble();
+  return den != 0 ? value.left(slash).toDouble() / den : 0.0;
+}
+
+void parseXmp(const QByteArray &xmp, ExifInfo *info) {
+  if (info->focalLength <= 0)
+    info->focalLength = xmpNumber(xmp, "exif:FocalLength");
+  if (info->focalLength35mm <= 0)
+    info->focalLength35mm = xmpNumber(xmp, "exif:FocalLengthIn35mmFilm");
+  if (info->focalPlanePixelsPerMm <= 0) {
+    const double resolution = xmpNumber(xmp, "exif:FocalPlaneXResolution");
+    const int unit = int(xmpNumber(xmp, "exif:FocalPlaneResolutionUnit"));
+    if (resolution > 0)
+      info->focalPlanePixelsPerMm = resolution / resolutionUnitMm(unit);
+  }
+  if (info->pixelWidth <= 0)
+    info->pixelWidth = int(xmpNumber(xmp, "exif:PixelXDimension"));
+  if (info->pixelHeight <= 0)
+    info->pixelHeight = int(xmpNumber(xmp, "exif:PixelYDimension"));
+  if (info->orientation <= 1) {
+    const int orientation = int(xmpNumber(xmp, "tiff:Orientation"));
+    if (orientation > 1 && orientation <= 8)
+      info->orientation = orientation;
+  }
+  if (info->make.isEmpty())
+    info->make = xmpValue(xmp, "tiff:Make");
+  if (info->model.isEmpty())
+    info->model = xmpValue(xmp, "tiff:Model");
+  if (info->lens.isEmpty())
+    info->lens = xmpValue(xmp, "exifEX:LensModel");
+  if (info->lens.isEmpty())
+    info->lens = xmpValue(xmp, "aux:Lens");
+}
+
+} // namespace
+
+ExifInfo readExif(QIODevice *device) {
+  ExifInfo info;
+  if (!device->isOpen() && !device->open(QIODevice::ReadOnly))
+    return info;
+  const QByteArray magic = device->peek(4);
+  if (magic.startsWith("II") || magic.startsWith("MM")) {
+    // Plain TIFF: the IFDs may sit anywhere, but rarely past the first MB.
+    parseTiff(device->read(1 << 20), &info);
+    return info;
+  }
+  if (!magic.startsWith("\xFF\xD8"))
+    return info;
+
+  static const QByteArray exifId("Exif\0\0", 6);
+  static const QByteArray xmpId("http://ns.adobe.com/xap/1.0/\0", 29);
+  QByteArray xmp;
+  device->read(2);
+  for (;;) {
+    const QByteArray header = device->read(4);
+    if (header.size() < 4 || uchar(header[0]) != 0xFF)
+      break;
+    const uchar marker = uchar(header[1]);
+    // Start of scan or end of image: no metadata past this point.
+    if (marker == 0xDA || marker == 0xD9)
+      break;
+    const int length = (uchar(header[2]) << 8 | uchar(header[3])) - 2;
+    if (length < 0)
+      break;
+    if (marker != 0xE1) {
+      if (!device->seek(device->pos() + length))
+        break;
+      continue;
+    }
+    const QByteArray segment = device->read(length);
+    if (segment.startsWith(exifId))
+      parseTiff(segment.mid(exifId.size()), &info);
+    else if (segment.startsWith(xmpId))
+      xmp = segment.mid(xmpId.size());
+  }
+  if (!xmp.isEmpty())
+    parseXmp(xmp, &info);
+  return info;
+}
+
+ExifInfo readExif(const QByteArray &data) {
+  QBuffer buffer;
+  buffer.setData(data);
+  return readExif(&buffer);
+}
+
+ExifInfo cachedExif(const QString &path) {
+  const QFileInfo file(path);
+  if (!file.isFile())
+    return ExifInfo();
+  const QString key = QStringLiteral("%1|%2|%3")
+                          .arg(file.absoluteFilePath())
+                          .arg(file.size())
+                          .arg(file.lastModified().toMSecsSinceEpoch());
+  static QMutex mutex;
+  static QHash<QString, ExifInfo> cache;
+  {
+    QMutexLocker lock(&mutex);
+    auto it = cache.constFind(key);
+    if (it != cache.constEnd())
+      return it.value();
+  }
+  QFile device(path);
+  const ExifInfo info = readExif(&device);
+  QMutexLocker lock(&mutex);
+  cache.insert(key, info);
+  return info;
+}
@@ -0,0 +1,44 @@
+#ifndef EXIF_READER_H
+#define EXIF_READER_H
+
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+
+// Camera metadata of one image from its EXIF block, with XMP filling in
+// whatever EXIF leaves out. Zero or empty means unknown.
+struct ExifInfo {
+  // Lens focal length and its 35 mm film equivalent, in mm.
+  double focalLength = 0;
+  double focalLength35mm = 0;
+  // Sensor pixels per mm in the focal plane along the sensor x axis, for
+  // an image pixelWidth x pixelHeight pixels large.
+  double focalPlanePixelsPerMm = 0;
+  int pixelWidth = 0;
+  int pixelHeight = 0;
+  // EXIF orientation 1..8; 5 to 8 swap the sensor axes on display.
+  int orientation = 1;
+  QString make;
+  QString model;
+  QString lens;
+
+  // Focal length in pixels of the displayed image, or 0 when the metadata
+  // does not allow one. Values no real lens produces are dropped.
+  double focalLengthPixels(int width, int height) const;
+
+  // Images with equal keys were taken with the same body, lens and zoom.
+  QString cameraKey() const;
+};
+
+// Reads the metadata of a JPEG or TIFF image. For JPEG only the APP1
+// segments are read; everything else, pixels included, is skipped.
+ExifInfo readExif(QIODevice *device);
+ExifInfo readExif(const QByteArray &data);
+
+// readExif() of a file, cached by path, size and modification time so
+// repeated calibrations of the same images parse each file once. Files
+// that do not exist yield an empty ExifInfo.
+ExifInfo cachedExif(const QString &path);
+
+#endif // EXIF_READER_H
@@ -77,6 +77,36 @@ bool saveAms(const QString &filepath, const QByteArray &jsonData, const QStringL
     return true;
 }
 
+bool saveAms(const QString &filepath, const QByteArray &jsonData, const QList<LoadedImage> &images)
+{
+    mz_zip_archive zipw{}; memset(&zipw, 0, sizeof(zipw));
+    if(!mz_zip_writer_init_file(&zipw, filepath.toUtf8().constData(), 0))
+        return false;
+
+    json j;
+    j["scene.json"] = md5String(jsonData).toStdString();
+    if(!mz_zip_writer_add_mem(&zipw, "scene.json", jsonData.constData(), jsonData.size(), MZ_BEST_COMPRESSION)) {
+        mz_zip_writer_end(&zipw);
+        return false;
+    }
+
+    for(const LoadedImage &img : images) {
+        std::string name = std::string("images/") + img.name.toStdString();
+        if(!mz_zip_writer_add_mem(&zipw, name.c_str(), img.data.constData(), img.data.size(), MZ_BEST_COMPRESSION)) {
+            mz_zip_writer_end(&zipw);
+            return false;
+        }
+        j[name] = md5String(img.data).toStdString();
+    }
+
+    std::string jstr = j.dump();
+    mz_zip_writer_add_mem(&zipw, "meta/hashmap.json", jstr.data(), jstr.size(), MZ_BEST_COMPRESSION);
+
+    bool ok = mz_zip_writer_finalize_archive(&zipw);
+    mz_zip_writer_end(&zipw);
+    return ok;
+}
+
 bool loadAms(const QString &filepath, QByteArray &jsonData, QList<LoadedImage> &images)
 {
     mz_zip_archive zip{}; memset(&zip, 0, sizeof(zip));
@@ -13,6 +13,9 @@ struct LoadedImage {
 };
 
 bool saveAms(const QString &filepath, const QByteArray &jsonData, const QStringList &imagePaths);
+// Writes the images from memory, e.g. when rewriting an archive that was
+// loaded on a machine without the original image files.
+bool saveAms(const QString &filepath, const QByteArray &jsonData, const QList<LoadedImage> &images);
 bool loadAms(const QString &filepath, QByteArray &jsonData, QList<LoadedImage> &images);
 
 #endif // FILESYSTEM_H
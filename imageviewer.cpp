@@ -6,22 +6,58 @@
 #include <QScrollBar>
 #include <QMouseEvent>
 #include <QPainter>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+// While panning or zooming the image is drawn from a downscaled copy with
+// nearest-neighbour sampling; full quality returns after this idle delay.
+static const int kIdleRepaintDelayMs = 150;
+static const int kPreviewMaxSide = 1024;
+static const int kStatsRefreshMs = 250;
 
 ImageViewer::ImageViewer(QWidget *parent)
     : QGraphicsView(parent),
       m_pixmapItem(new QGraphicsPixmapItem()),
+      m_markerItem(new MarkerItem()),
       m_panning(false),
       m_addingLocator(false),
       m_zoomStep(1.2),
-      m_toolController(nullptr)
+      m_toolController(nullptr),
+      m_idleTimer(new QTimer(this)),
+      m_interacting(false),
+      m_statsOverlay(false),
+      m_statsTimer(new QTimer(this))
 {
     setScene(new QGraphicsScene(this));
+    m_pixmapItem->setTransformationMode(Qt::SmoothTransformation);
     scene()->addItem(m_pixmapItem);
+    m_markerItem->setZValue(1);
+    m_markerItem->setStats(&m_stats);
+    scene()->addItem(m_markerItem);
 
     setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
     setDragMode(QGraphicsView::NoDrag);
     setTransformationAnchor(QGraphicsView::NoAnchor);
     setResizeAnchor(QGraphicsView::NoAnchor);
+
+    m_idleTimer->setSingleShot(true);
+    m_idleTimer->setInterval(kIdleRepaintDelayMs);
+    connect(m_idleTimer, &QTimer::timeout, this, &ImageViewer::endInteraction);
+
+    // The overlay reads numbers of past frames, so refresh it periodically
+    // rather than from paintEvent.
+    m_statsTimer->setInterval(kStatsRefreshMs);
+    connect(m_statsTimer, &QTimer::timeout, this, &ImageViewer::refreshStatsOverlay);
+
+    m_previewPool.setMaxThreadCount(1);
+}
+
+ImageViewer::~ImageViewer()
+{
+    // A running preview job posts back to this object; let it finish first.
+    m_previewPool.clear();
+    m_previewPool.waitForDone();
 }
 
 void ImageViewer::setToolController(ToolController *controller)
@@ -36,7 +72,15 @@ void ImageViewer::loadImage(const QImage &img, bool keepTransform)
     int v = verticalScrollBar()->value();
 
     scene()->setSceneRect(0, 0, img.width(), img.height());
-    m_pixmapItem->setPixmap(QPixmap::fromImage(img));
+    QElapsedTimer timer;
+    timer.start();
+    m_fullPixmap = QPixmap::fromImage(img);
+    m_stats.record(ViewerStats::ImageConversionTime, timer.nsecsElapsed() / 1e6);
+    m_previewPixmap = QPixmap();
+    m_pixmapItem->setScale(1.0);
+    m_pixmapItem->setPixmap(m_fullPixmap);
+    m_markerItem->setImageSize(img.size());
+    buildPreview(img);
 
     if (keepTransform) {
         setTransform(current);
@@ -48,29 +92,180 @@ void ImageViewer::loadImage(const QImage &img, bool keepTransform)
     }
 }
 
-void ImageViewer::setMarkers(const QList<ViewerMarker> &markers)
+// Scales the preview on a worker thread as soon as an image is shown, so the
+// first pan or zoom already finds it. Results for an image that has been
+// replaced in the meantime are dropped.
+void ImageViewer::buildPreview(const QImage &img)
 {
-    for (QGraphicsItem *it : m_markerItems)
-        scene()->removeItem(it);
-    m_markerItems.clear();
-
-    for (const ViewerMarker &m : markers) {
-        QPointF pos(m.x * sceneRect().width(), m.y * sceneRect().height());
-        QPen pen(errorToColor(m.error));
-        pen.setWidth(m.highlight ? 2 : 1);
-        QGraphicsLineItem *l1 = scene()->addLine(-5, 0, 5, 0, pen);
-        QGraphicsLineItem *l2 = scene()->addLine(0, -5, 0, 5, pen);
-        l1->setPos(pos);
-        l2->setPos(pos);
-        l1->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-        l2->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-        m_markerItems << l1 << l2;
-
-        QGraphicsSimpleTextItem *txt = scene()->addSimpleText(m.name);
-        txt->setPos(pos + QPointF(6, -6));
-        txt->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-        m_markerItems << txt;
+    const int generation = ++m_previewGeneration;
+    m_previewPool.clear();
+    if (qMax(img.width(), img.height()) <= kPreviewMaxSide)
+        return;
+    m_previewPool.start([this, img, generation]() {
+        const QImage scaled = img.scaled(kPreviewMaxSide, kPreviewMaxSide,
+                                         Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        QMetaObject::invokeMethod(this, [this, scaled, generation]() {
+            if (generation != m_previewGeneration)
+                return;
+            m_previewPixmap = QPixmap::fromImage(scaled);
+            if (m_interacting)
+                updateInteractionPixmap();
+        }, Qt::QueuedConnection);
+    });
+}
+
+// Draws the preview while it still has at least half the resolution the view
+// is showing and the full image otherwise. Called on every scale change, so
+// zooming in during an interaction switches back to full resolution.
+void ImageViewer::updateInteractionPixmap()
+{
+    qreal previewScale = 1.0;
+    bool usePreview = false;
+    if (!m_previewPixmap.isNull() && !m_fullPixmap.isNull()) {
+        previewScale = qreal(m_previewPixmap.width()) / m_fullPixmap.width();
+        usePreview = transform().m11() <= 2.0 * previewScale;
     }
+    const QPixmap &wanted = usePreview ? m_previewPixmap : m_fullPixmap;
+    if (m_pixmapItem->pixmap().cacheKey() == wanted.cacheKey())
+        return;
+    m_pixmapItem->setPixmap(wanted);
+    m_pixmapItem->setScale(usePreview ? 1.0 / previewScale : 1.0);
+}
+
+void ImageViewer::beginInteraction()
+{
+    m_idleTimer->start();
+    if (!m_interacting) {
+        m_interacting = true;
+        setRenderHint(QPainter::Antialiasing, false);
+        setRenderHint(QPainter::SmoothPixmapTransform, false);
+        m_pixmapItem->setTransformationMode(Qt::FastTransformation);
+        if (qMax(m_fullPixmap.width(), m_fullPixmap.height()) > kPreviewMaxSide)
+            m_stats.recordCacheAccess(ViewerStats::PreviewCache, !m_previewPixmap.isNull());
+    }
+    updateInteractionPixmap();
+}
+
+void ImageViewer::endInteraction()
+{
+    if (!m_interacting)
+        return;
+    m_interacting = false;
+    m_pixmapItem->setScale(1.0);
+    m_pixmapItem->setPixmap(m_fullPixmap);
+    m_pixmapItem->setTransformationMode(Qt::SmoothTransformation);
+    setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
+    viewport()->update();
+}
+
+void ImageViewer::setMarkers(const QList<ViewerMarker> &markers)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_markerItem->setMarkers(markers);
+    m_stats.record(ViewerStats::MarkerRebuildTime, timer.nsecsElapsed() / 1e6);
+}
+
+void ImageViewer::updateMarker(const ViewerMarker &marker)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_markerItem->updateMarker(marker);
+    m_stats.record(ViewerStats::MarkerRebuildTime, timer.nsecsElapsed() / 1e6);
+}
+
+void ImageViewer::removeMarker(const QString &name)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_markerItem->removeMarker(name);
+    m_stats.record(ViewerStats::MarkerRebuildTime, timer.nsecsElapsed() / 1e6);
+}
+
+void ImageViewer::setStatsOverlayVisible(bool visible)
+{
+    if (m_statsOverlay == visible)
+        return;
+    m_statsOverlay = visible;
+    if (visible)
+        m_statsTimer->start();
+    else
+        m_statsTimer->stop();
+    viewport()->update();
+}
+
+QFont ImageViewer::statsOverlayFont() const
+{
+    QFont font = viewport()->font();
+    font.setStyleHint(QFont::Monospace);
+    font.setFamily(QStringLiteral("monospace"));
+    return font;
+}
+
+QRect ImageViewer::statsOverlayBox(const QStringList &lines) const
+{
+    QFontMetrics fm(statsOverlayFont());
+    int width = 0;
+    for (const QString &line : lines)
+        width = qMax(width, fm.horizontalAdvance(line));
+    return QRect(8, 8, width + 12, fm.height() * lines.size() + 8);
+}
+
+// Repaints only the old and new extent of the overlay box instead of the
+// whole viewport.
+void ImageViewer::refreshStatsOverlay()
+{
+    const QRect box = statsOverlayBox(m_stats.summary());
+    m_statsOverlayDirty = m_statsOverlayRect.united(box);
+    viewport()->update(m_statsOverlayDirty);
+}
+
+void ImageViewer::paintEvent(QPaintEvent *event)
+{
+    // Frames that only refresh the overlay would skew the numbers it shows.
+    const bool overlayOnly = !m_statsOverlayDirty.isEmpty()
+            && m_statsOverlayDirty.contains(event->rect());
+    m_statsOverlayDirty = QRect();
+    QElapsedTimer timer;
+    timer.start();
+    QGraphicsView::paintEvent(event);
+    if (!overlayOnly)
+        m_stats.record(ViewerStats::PaintTime, timer.nsecsElapsed() / 1e6);
+}
+
+void ImageViewer::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsView::drawForeground(painter, rect);
+    if (!m_statsOverlay)
+        return;
+    const QStringList lines = m_stats.summary();
+    painter->save();
+    painter->resetTransform();
+    const QFont font = statsOverlayFont();
+    painter->setFont(font);
+    QFontMetrics fm(font);
+    const QRect box = statsOverlayBox(lines);
+    m_statsOverlayRect = box;
+    painter->fillRect(box, QColor(0, 0, 0, 160));
+    painter->setPen(Qt::white);
+    for (int i = 0; i < lines.size(); ++i)
+        painter->drawText(box.left() + 6, box.top() + 4 + fm.ascent() + i * fm.height(), lines[i]);
+    painter->restore();
+}
+
+QString ImageViewer::markerAt(const QPointF &scenePos, qreal radius) const
+{
+    return m_markerItem->markerAt(m_markerItem->mapFromScene(scenePos), radius);
+}
+
+QStringList ImageViewer::markersIn(const QRectF &sceneRect) const
+{
+    return m_markerItem->markersIn(m_markerItem->mapRectFromScene(sceneRect));
+}
+
+void ImageViewer::setHoveredMarker(const QString &name)
+{
+    m_markerItem->setHoveredMarker(name);
 }
 
 void ImageViewer::setAddingLocator(bool adding)
@@ -82,6 +277,7 @@ void ImageViewer::setAddingLocator(bool adding)
 void ImageViewer::mousePressEvent(QMouseEvent *event)
 {
     if (m_toolController) {
+        event->ignore();
         m_toolController->mousePressEvent(event);
         if (event->isAccepted())
             return;
@@ -99,6 +295,7 @@ void ImageViewer::mousePressEvent(QMouseEvent *event)
         m_panning = true;
         m_panStart = event->pos();
         setCursor(Qt::ClosedHandCursor);
+        beginInteraction();
     } else {
         QGraphicsView::mousePressEvent(event);
     }
@@ -122,11 +319,13 @@ void ImageViewer::mousePressEvent(QMouseEvent *event)
 void ImageViewer::mouseMoveEvent(QMouseEvent *event)
 {
     if (m_toolController) {
+        event->ignore();
         m_toolController->mouseMoveEvent(event);
         if (event->isAccepted())
             return;
     }
     if (m_panning) {
+        beginInteraction();
         QPoint delta = event->pos() - m_panStart;
         m_panStart = event->pos();
         horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
@@ -139,6 +338,7 @@ void ImageViewer::mouseMoveEvent(QMouseEvent *event)
 void ImageViewer::mouseReleaseEvent(QMouseEvent *event)
 {
     if (m_toolController) {
+        event->ignore();
         m_toolController->mouseReleaseEvent(event);
         if (event->isAccepted())
             return;
@@ -158,6 +358,7 @@ void ImageViewer::wheelEvent(QWheelEvent *event)
         emit navigate(step);
         return;
     }
+    beginInteraction();
     QPointF oldPos = mapToScene(event->position().toPoint());
     bool zoomOut = event->angleDelta().y() < 0;
     qreal factor = zoomOut ? 1.0 / m_zoomStep : m_zoomStep;
@@ -165,6 +366,7 @@ void ImageViewer::wheelEvent(QWheelEvent *event)
     QPointF newPos = mapToScene(event->position().toPoint());
     QPointF delta = newPos - oldPos;
     translate(delta.x(), delta.y());
+    updateInteractionPixmap();
 }
 
 void ImageViewer::mouseDoubleClickEvent(QMouseEvent *event)
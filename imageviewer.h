@@ -7,27 +7,37 @@
 #include <QMenu>
 #include <QList>
 #include <QPointF>
+#include <QPixmap>
+#include <QThreadPool>
 #include "tools.h"
+#include "markeritem.h"
+#include "viewerstats.h"
 
-struct ViewerMarker {
-    float x;
-    float y;
-    QString name;
-    float error = 0.0f;
-    bool highlight = false;
-};
+class QTimer;
 
 class ImageViewer : public QGraphicsView
 {
     Q_OBJECT
 public:
     explicit ImageViewer(QWidget *parent = nullptr);
+    ~ImageViewer() override;
     void setToolController(ToolController *controller);
 
     void loadImage(const QImage &img, bool keepTransform = false);
     void setMarkers(const QList<ViewerMarker> &markers);
+    void updateMarker(const ViewerMarker &marker);
+    void removeMarker(const QString &name);
     void setAddingLocator(bool adding);
 
+    QString markerAt(const QPointF &scenePos, qreal radius) const;
+    QStringList markersIn(const QRectF &sceneRect) const;
+    void setHoveredMarker(const QString &name);
+
+    ViewerStats &stats() { return m_stats; }
+    const ViewerStats &stats() const { return m_stats; }
+    void setStatsOverlayVisible(bool visible);
+    bool isStatsOverlayVisible() const { return m_statsOverlay; }
+
 signals:
     void locatorAdded(float x, float y);
     void navigate(int step);
@@ -38,15 +48,40 @@ protected:
     void mouseReleaseEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
     void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
+
+private slots:
+    void endInteraction();
+    void refreshStatsOverlay();
 
 private:
+    void beginInteraction();
+    void buildPreview(const QImage &img);
+    void updateInteractionPixmap();
+    QFont statsOverlayFont() const;
+    QRect statsOverlayBox(const QStringList &lines) const;
+
     QGraphicsPixmapItem *m_pixmapItem;
-    QList<QGraphicsItem *> m_markerItems;
+    MarkerItem *m_markerItem;
     bool m_panning;
     QPoint m_panStart;
     bool m_addingLocator;
     qreal m_zoomStep;
     ToolController *m_toolController;
+    QPixmap m_fullPixmap;
+    QPixmap m_previewPixmap;
+    QThreadPool m_previewPool;
+    int m_previewGeneration = 0;
+    QTimer *m_idleTimer;
+    bool m_interacting;
+    ViewerStats m_stats;
+    bool m_statsOverlay;
+    QTimer *m_statsTimer;
+    // Last drawn overlay box and the region of a pending overlay-only repaint,
+    // in viewport coordinates.
+    QRect m_statsOverlayRect;
+    QRect m_statsOverlayDirty;
 };
 
 #endif // IMAGEVIEWER_H
@@ -11,11 +11,18 @@
 #include "tools.h"
 //#include <event.h>
 #include <QMimeData>
-#include <optional>
+#include <QSignalBlocker>
+#include <QProgressDialog>
+#include <QThread>
+#include <QGuiApplication>
+#include <QElapsedTimer>
 #include <limits>
 #include <cmath>
-#include <Eigen/Core>
-#include <Eigen/SVD>
+#include <algorithm>
+
+// Bundle adjustment reports every iteration; the dialog only needs a few
+// updates per second.
+static const int kProgressIntervalMs = 100;
 
 
 MainWindow::MainWindow(QWidget *parent)
@@ -24,7 +31,10 @@ MainWindow::MainWindow(QWidget *parent)
       viewer(nullptr),
       currentIndex(-1),
       m_toolController(nullptr),
-      m_addLocatorTool(nullptr)
+      m_addLocatorTool(nullptr),
+      m_selectTool(nullptr),
+      m_calibrationThread(nullptr),
+      m_calibrationDialog(nullptr)
 {
     ui->setupUi(this);
     setAcceptDrops(true);
@@ -38,11 +48,17 @@ MainWindow::MainWindow(QWidget *parent)
     connect(m_addLocatorTool, &AddLocatorTool::locatorCreated,
             this, &MainWindow::onLocatorAdded);
     m_toolController->registerTool(ToolType::AddLocator, m_addLocatorTool);
+    m_selectTool = new SelectTool(viewer, m_toolController);
+    connect(m_selectTool, &SelectTool::markerPicked, this, &MainWindow::onMarkerPicked);
+    connect(m_selectTool, &SelectTool::markerDragged, this, &MainWindow::onMarkerDragged);
+    connect(m_selectTool, &SelectTool::markersSelected, this, &MainWindow::onMarkersSelected);
+    m_toolController->registerTool(ToolType::Select, m_selectTool);
     m_toolController->registerTool(ToolType::DefineMeasurements,
                                    new DefineMeasurementsTool(viewer, m_toolController));
     m_toolController->registerTool(ToolType::DefineWorldspace,
                                    new DefineWorldspaceTool(viewer, m_toolController));
     viewer->setToolController(m_toolController);
+    m_toolController->setActiveTool(ToolType::Select);
 
     locatorMode = false;
     sceneFilePath.clear();
@@ -77,10 +93,21 @@ MainWindow::MainWindow(QWidget *parent)
     connect(delShort, &QShortcut::activated, this, &MainWindow::deleteSelectedLocator);
     QShortcut *escShort = new QShortcut(QKeySequence(Qt::Key_Escape), viewer);
     connect(escShort, &QShortcut::activated, this, &MainWindow::exitLocatorMode);
+    QShortcut *statsShort = new QShortcut(QKeySequence(Qt::Key_F3), this);
+    connect(statsShort, &QShortcut::activated, this, [this]() {
+        viewer->setStatsOverlayVisible(!viewer->isStatsOverlayVisible());
+    });
 }
 
 MainWindow::~MainWindow()
 {
+    if (m_calibrationThread) {
+        m_calibrator->requestCancel();
+        m_calibrationThread->wait();
+        // The finished() -> deleteLater() path never runs during destruction.
+        delete m_calibrationThread;
+        m_calibrationThread = nullptr;
+    }
     delete ui;
 }
 
@@ -89,10 +116,14 @@ void MainWindow::importImages()
     QStringList paths = QFileDialog::getOpenFileNames(this, tr("Select Images"), QString(), tr("Images (*.png *.jpg *.jpeg *.tif)"));
     paths = verifyPaths(paths);
     imagePaths = paths;
-    images = loadImages(paths);
+    images = loadImagesTimed(paths);
     locators.clear();
     selectedLocator.clear();
+    selectedLocators.clear();
     imageErrors.clear();
+    outlierImages.clear();
+    cameras.clear();
+    m_calibrator.reset();
     if (!images.isEmpty()) {
         showImage(0);
     } else {
@@ -130,39 +161,48 @@ void MainWindow::onLocatorAdded(float x, float y)
     for (LocatorData &l : locators) {
         if (l.name == selectedLocator) {
             l.positions.insert(currentIndex, QPointF(x, y));
+            viewer->updateMarker(markerFor(l, currentIndex));
             break;
         }
     }
-    QList<ViewerMarker> markers;
-    for (const LocatorData &l : locators) {
-        if (l.positions.contains(currentIndex)) {
-            QPointF p = l.positions.value(currentIndex);
-            ViewerMarker m{static_cast<float>(p.x()), static_cast<float>(p.y()), l.name, l.error, l.name == selectedLocator};
-            markers.append(m);
-        }
-    }
-    viewer->setMarkers(markers);
     updateTree();
 }
 
+QVector<QImage> MainWindow::loadImagesTimed(const QStringList &paths)
+{
+    QVector<double> decodeMs;
+    QVector<QImage> result = loadImages(paths, &decodeMs);
+    for (double ms : decodeMs)
+        viewer->stats().record(ViewerStats::DecodeTime, ms);
+    return result;
+}
+
 void MainWindow::showImage(int index, bool keepView)
 {
     if (index < 0 || index >= images.size())
         return;
     currentIndex = index;
     viewer->loadImage(images[index], keepView);
+    refreshMarkers();
+}
 
+void MainWindow::refreshMarkers()
+{
     QList<ViewerMarker> markers;
     for (const LocatorData &l : locators) {
-        if (l.positions.contains(index)) {
-            QPointF p = l.positions.value(index);
-            ViewerMarker m{static_cast<float>(p.x()), static_cast<float>(p.y()), l.name, l.error, l.name == selectedLocator};
-            markers.append(m);
-        }
+        if (l.positions.contains(currentIndex))
+            markers.append(markerFor(l, currentIndex));
     }
     viewer->setMarkers(markers);
 }
 
+ViewerMarker MainWindow::markerFor(const LocatorData &l, int index) const
+{
+    QPointF p = l.positions.value(index);
+    bool highlight = l.name == selectedLocator || selectedLocators.contains(l.name);
+    return ViewerMarker{static_cast<float>(p.x()), static_cast<float>(p.y()), l.name, l.error, highlight};
+}
+
 void MainWindow::nextImage()
 {
     if (images.isEmpty()) return;
@@ -184,7 +224,12 @@ void MainWindow::newScene()
     images.clear();
     locators.clear();
     selectedLocator.clear();
+    selectedLocators.clear();
     imageErrors.clear();
+    outlierImages.clear();
+    cameras.clear();
+    m_calibrator.reset();
+    setCalibrationProfile(CalibrationProfile::Balanced);
     sceneFilePath.clear();
     currentIndex = -1;
     viewer->loadImage(QImage());
@@ -198,7 +243,8 @@ void MainWindow::saveSceneTriggered()
         saveSceneAsTriggered();
         return;
     }
-    if (!saveScene(sceneFilePath, imagePaths, locators)) {
+    if (!saveScene(sceneFilePath, imagePaths, locators,
+                   calibrationProfileName(calibrationProfile()), cameras)) {
         QMessageBox::critical(this, tr("Save Failed"), tr("Could not save scene."));
     }
 }
@@ -221,21 +267,41 @@ void MainWindow::loadSceneTriggered(QString filename)
         return;
     QStringList imgs;
     QList<LocatorData> locs;
-    if (!loadSceneAms(path, imgs, locs)) {
+    QList<CameraData> cams;
+    QString profileName;
+    if (!loadSceneAms(path, imgs, locs, &profileName, &cams)) {
         QMessageBox::critical(this, tr("Load Failed"), tr("Could not load scene."));
         return;
     }
     sceneFilePath = path;
     imagePaths = imgs;
-    images = loadImages(imgs);
+    images = loadImagesTimed(imgs);
     locators = locs;
     selectedLocator.clear();
+    selectedLocators.clear();
     imageErrors.clear();
+    outlierImages.clear();
+    cameras = cams;
+    m_calibrator.reset();
+    CalibrationProfile profile = CalibrationProfile::Balanced;
+    parseCalibrationProfile(profileName, &profile);
+    setCalibrationProfile(profile);
     if (!images.isEmpty())
         showImage(0);
     updateTree();
 }
 
+// The combo box lists the profiles in enum order.
+CalibrationProfile MainWindow::calibrationProfile() const
+{
+    return static_cast<CalibrationProfile>(ui->cmbProfile->currentIndex());
+}
+
+void MainWindow::setCalibrationProfile(CalibrationProfile profile)
+{
+    ui->cmbProfile->setCurrentIndex(static_cast<int>(profile));
+}
+
 void MainWindow::calibrate()
 {
     if (imagePaths.isEmpty()) {
@@ -244,8 +310,8 @@ void MainWindow::calibrate()
         return;
     }
 
-    CameraCalibrator calibrator;
-    calibrator.loadImages(imagePaths);
+    if (m_calibrationThread)
+        return;
 
     QMap<int, QMap<int, QPointF>> pointData;
     for (int setId = 0; setId < locators.size(); ++setId) {
@@ -264,92 +330,175 @@ void MainWindow::calibrate()
             pointData.insert(setId, map);
     }
 
-    calibrator.loadPointData(pointData);
-    if (!calibrator.calibrate()) {
+    // Later runs on the same images start from the previous solution, which
+    // keeps small locator edits cheap. Shift+Calibrate forces a full solve.
+    const bool full = !m_calibrator || !m_calibrator->hasSolution()
+            || QGuiApplication::keyboardModifiers().testFlag(Qt::ShiftModifier);
+    if (!m_calibrator) {
+        m_calibrator = std::make_shared<CameraCalibrator>();
+        m_calibrator->setMultiStartRuns(qBound(1, QThread::idealThreadCount() / 2, 4));
+        // Only projects larger than the partition size are split up.
+        m_calibrator->setSolver(CameraCalibrator::Solver::Partitioned);
+    }
+    m_calibrator->setProfile(calibrationProfile());
+    // Rejected clicks are listed in the tree, so the GUI can afford to drop them.
+    m_calibrator->setRejectOutliers(true);
+    m_calibrator->loadPointData(pointData);
+
+    // Progress arrives on the worker thread; hop to the GUI thread. Stage
+    // changes always go through, other updates at most every interval. The
+    // callback lives in the calibrator, so it only holds a weak reference.
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+    int lastStage = -1;
+    std::weak_ptr<CameraCalibrator> run = m_calibrator;
+    m_calibrator->setProgressCallback([this, run, progressTimer, lastStage](
+                                          const CalibrationProgress &progress) mutable {
+        if (progress.stage == lastStage && progressTimer.elapsed() < kProgressIntervalMs)
+            return;
+        lastStage = progress.stage;
+        progressTimer.restart();
+        std::shared_ptr<CameraCalibrator> calibrator = run.lock();
+        if (!calibrator)
+            return;
+        QMetaObject::invokeMethod(this, [this, calibrator, progress]() {
+            onCalibrationProgress(calibrator, progress);
+        }, Qt::QueuedConnection);
+    });
+
+    m_calibrationDialog = new QProgressDialog(tr("Preparing calibration..."), tr("Cancel"),
+                                              0, imagePaths.size(), this);
+    m_calibrationDialog->setWindowTitle(tr("Calibrate"));
+    m_calibrationDialog->setWindowModality(Qt::WindowModal);
+    m_calibrationDialog->setMinimumDuration(0);
+    m_calibrationDialog->setAutoClose(false);
+    m_calibrationDialog->setAutoReset(false);
+    m_calibrationDialog->setValue(0);
+    std::shared_ptr<CameraCalibrator> calibrator = m_calibrator;
+    connect(m_calibrationDialog, &QProgressDialog::canceled, this, [this, calibrator]() {
+        calibrator->requestCancel();
+        m_calibrationDialog->setLabelText(tr("Cancelling..."));
+    });
+
+    QStringList paths = imagePaths;
+    auto ok = std::make_shared<bool>(false);
+    m_calibrationThread = QThread::create([calibrator, paths, ok, full]() {
+        if (full) {
+            calibrator->loadImages(paths);
+            *ok = calibrator->calibrate();
+        } else {
+            *ok = calibrator->refine();
+        }
+    });
+    connect(m_calibrationThread, &QThread::finished, this, [this, ok]() {
+        onCalibrationFinished(*ok);
+    });
+    m_calibrationThread->start();
+}
+
+void MainWindow::onCalibrationProgress(const std::shared_ptr<CameraCalibrator> &calibrator,
+                                       const CalibrationProgress &progress)
+{
+    // Updates queued by an earlier run may arrive after it was replaced.
+    if (!m_calibrationDialog || calibrator != m_calibrator || calibrator->wasCancelled())
+        return;
+    QString text;
+    switch (progress.stage) {
+    case CalibrationProgress::Preparing:
+        text = tr("Preparing calibration...");
+        break;
+    case CalibrationProgress::Initializing:
+        text = tr("Searching for an initial image pair...");
+        break;
+    case CalibrationProgress::Registering:
+        text = tr("Registered %1 of %2 images").arg(progress.registeredIndices.size())
+                   .arg(progress.totalImages);
+        break;
+    case CalibrationProgress::Refining:
+        text = tr("Refining %1 cameras").arg(progress.registeredIndices.size());
+        break;
+    case CalibrationProgress::Finished:
+        text = tr("Finishing...");
+        break;
+    }
+    if (progress.baIterations > 0)
+        text += tr(" (bundle adjustment iteration %1)").arg(progress.baIterations);
+    m_calibrationDialog->setLabelText(text);
+    m_calibrationDialog->setValue(progress.registeredIndices.size());
+
+    // Show which images already have a pose while the solve continues.
+    QHash<int, int> registered;
+    registered.reserve(progress.registeredIndices.size());
+    for (int k = 0; k < progress.registeredIndices.size(); ++k)
+        registered.insert(progress.registeredIndices[k], k);
+    QTreeWidgetItem *imgRoot = ui->MainTree->topLevelItemCount() > 0 ? ui->MainTree->topLevelItem(0) : nullptr;
+    if (!imgRoot)
+        return;
+    for (int i = 0; i < imgRoot->childCount(); ++i) {
+        QTreeWidgetItem *it = imgRoot->child(i);
+        const int position = registered.value(i, -1);
+        const bool isRegistered = position >= 0;
+        QPixmap pix(16, 16);
+        pix.fill(isRegistered ? QColor(0, 120, 255) : QColor(128, 128, 128));
+        it->setIcon(0, QIcon(pix));
+        if (isRegistered && position < progress.cameraCenters.size()) {
+            QVector3D c = progress.cameraCenters[position];
+            it->setToolTip(0, tr("Registered, centre (%1, %2, %3)")
+                                  .arg(c.x(), 0, 'f', 3).arg(c.y(), 0, 'f', 3).arg(c.z(), 0, 'f', 3));
+        }
+    }
+}
+
+void MainWindow::onCalibrationFinished(bool ok)
+{
+    std::shared_ptr<CameraCalibrator> calibrator = m_calibrator;
+    m_calibrationThread->deleteLater();
+    m_calibrationThread = nullptr;
+    // hide() rather than close(): closing a QProgressDialog emits canceled().
+    m_calibrationDialog->hide();
+    m_calibrationDialog->deleteLater();
+    m_calibrationDialog = nullptr;
+
+    if (!ok) {
+        updateTree();
+        if (calibrator->wasCancelled())
+            return;
         QMessageBox::critical(this, tr("Calibrate"),
                               tr("Calibration failed. Check your points."));
         return;
     }
 
-    imageErrors = calibrator.getReprojectionErrorPerImage();
-
-    // Compute per-locator errors
-    QMap<int, Eigen::Matrix<double, 3, 4>> Pmats;
-    QVector<int> regIdx = calibrator.getRegisteredIndices();
-    auto intr = calibrator.getIntrinsics();
-    auto rot = calibrator.getRotations();
-    auto trans = calibrator.getTranslations();
-    for (int idx : regIdx) {
-        if (idx >= intr.size() || idx >= rot.size() || idx >= trans.size())
+    cameras.clear();
+    const CameraSolution *solved = calibrator->cameraData();
+    for (int idx = 0; idx < calibrator->cameraCount(); ++idx) {
+        if (!solved[idx].valid)
             continue;
-        Eigen::Matrix3d K, Rwc;
-        for (int r = 0; r < 3; ++r) {
-            for (int c = 0; c < 3; ++c) {
-                K(r, c) = intr[idx](r, c);
-                Rwc(r, c) = rot[idx](r, c);
-            }
-        }
-        Eigen::Vector3d twc(trans[idx].x(), trans[idx].y(), trans[idx].z());
-        Eigen::Matrix3d Rcw = Rwc.transpose();
-        Eigen::Vector3d tcw = -Rcw * twc;
-        Eigen::Matrix<double, 3, 4> P;
-        P.leftCols<3>() = Rcw;
-        P.col(3) = tcw;
-        P = K * P;
-        Pmats[idx] = P;
+        CameraData camera;
+        camera.image = idx;
+        camera.intrinsics = solved[idx].intrinsicMatrix();
+        camera.rotation = solved[idx].rotationMatrix();
+        camera.translation = solved[idx].center();
+        cameras.append(camera);
     }
 
-    auto triangulatePointFn = [](const QMap<int, QPointF> &obs,
-                                 const QMap<int, Eigen::Matrix<double, 3, 4>> &P) {
-        std::vector<Eigen::Vector4d> rows;
-        for (auto it = obs.begin(); it != obs.end(); ++it) {
-            int i = it.key();
-            if (!P.contains(i))
-                continue;
-            const auto &mat = P[i];
-            double x = it.value().x();
-            double y = it.value().y();
-            rows.emplace_back(x * mat.row(2) - mat.row(0));
-            rows.emplace_back(y * mat.row(2) - mat.row(1));
-        }
-        if (rows.size() < 4)
-            return std::optional<Eigen::Vector3d>();
-        Eigen::MatrixXd A(rows.size(), 4);
-        for (int i = 0; i < rows.size(); ++i)
-            A.row(i) = rows[i];
-        Eigen::JacobiSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeFullV);
-        Eigen::Vector4d X = svd.matrixV().col(3);
-        X /= X(3);
-        return std::optional<Eigen::Vector3d>(X.head<3>());
-    };
-
-    for (int setId : pointData.keys()) {
-        const auto &obs = pointData[setId];
-        auto optX = triangulatePointFn(obs, Pmats);
-        if (!optX) {
-            locators[setId].error = std::numeric_limits<float>::infinity();
-            continue;
-        }
-        Eigen::Vector4d Xh;
-        Xh << *optX, 1.0;
-        double total = 0.0;
-        int count = 0;
-        for (auto it = obs.begin(); it != obs.end(); ++it) {
-            int i = it.key();
-            if (!Pmats.contains(i))
-                continue;
-            const auto &P = Pmats[i];
-            Eigen::Vector3d proj = P * Xh;
-            proj /= proj(2);
-            QPointF pt = it.value();
-            double err = std::hypot(pt.x() - proj(0), pt.y() - proj(1));
-            total += err;
-            count += 1;
-        }
-        if (count)
-            locators[setId].error = static_cast<float>(total / count);
-        else
-            locators[setId].error = std::numeric_limits<float>::infinity();
+    const ReprojectionErrors errors = calibrator->getReprojectionErrors();
+    imageErrors = errors.perImage;
+    for (int setId = 0; setId < errors.perLocator.size() && setId < locators.size(); ++setId)
+        locators[setId].error = static_cast<float>(errors.perLocator[setId]);
+
+    // Clicks the calibrator rejected; they are left in place for the user to fix.
+    QHash<QPair<int, int>, double> rejectedErrors;
+    for (int k = 0; k < errors.observationRejected.size(); ++k) {
+        if (errors.observationRejected[k])
+            rejectedErrors.insert(qMakePair(errors.observationLocators[k], errors.observationImages[k]),
+                                  errors.observationErrors[k]);
+    }
+    outlierImages.clear();
+    for (const LocatorObservation &obs : calibrator->outliers()) {
+        if (obs.locator >= 0 && obs.locator < locators.size())
+            outlierImages[locators[obs.locator].name].append(
+                qMakePair(obs.image, rejectedErrors.value(qMakePair(obs.locator, obs.image),
+                                                          std::numeric_limits<double>::infinity())));
     }
 
     updateTree();
@@ -411,7 +560,7 @@ void MainWindow::updateTree()
     for (int i = 0; i < imagePaths.size(); ++i) {
         QTreeWidgetItem *it = new QTreeWidgetItem(imgRoot, QStringList(QFileInfo(imagePaths[i]).fileName()));
         float err = 0.0f;
-        if(imageErrors.contains(i)) err = imageErrors.value(i);
+        if(i < imageErrors.size()) err = imageErrors[i];
         QPixmap pix(16,16); pix.fill(errorToColor(err));
         it->setIcon(0,QIcon(pix));
     }
@@ -420,6 +569,19 @@ void MainWindow::updateTree()
         QTreeWidgetItem *it = new QTreeWidgetItem(locRoot, QStringList(l.name));
         QPixmap pix(16,16); pix.fill(errorToColor(l.error));
         it->setIcon(0,QIcon(pix));
+        auto outliers = outlierImages.constFind(l.name);
+        if (outliers != outlierImages.constEnd()) {
+            QStringList names;
+            for (const QPair<int, double> &outlier : outliers.value()) {
+                const int idx = outlier.first;
+                QString name = idx >= 0 && idx < imagePaths.size() ? QFileInfo(imagePaths[idx]).fileName() : QString::number(idx);
+                if (std::isfinite(outlier.second))
+                    name += tr(" (%1 px)").arg(outlier.second, 0, 'f', 1);
+                names << name;
+            }
+            it->setForeground(0, QBrush(Qt::red));
+            it->setToolTip(0, tr("Rejected as an outlier in: %1").arg(names.join(", ")));
+        }
     }
     imgRoot->setExpanded(true);
     locRoot->setExpanded(true);
@@ -428,7 +590,54 @@ void MainWindow::updateTree()
 void MainWindow::exitLocatorMode()
 {
     locatorMode = false;
-    m_toolController->setActiveTool(ToolType::None);
+    m_toolController->setActiveTool(ToolType::Select);
+}
+
+void MainWindow::onMarkerPicked(const QString &name)
+{
+    selectedLocator = name;
+    selectedLocators = {name};
+    refreshMarkers();
+    selectTreeLocator(name);
+}
+
+void MainWindow::onMarkerDragged(const QString &name, float x, float y)
+{
+    if (currentIndex < 0)
+        return;
+    for (LocatorData &l : locators) {
+        if (l.name == name) {
+            l.positions.insert(currentIndex, QPointF(std::clamp(x, 0.0f, 1.0f),
+                                                     std::clamp(y, 0.0f, 1.0f)));
+            viewer->updateMarker(markerFor(l, currentIndex));
+            break;
+        }
+    }
+}
+
+void MainWindow::onMarkersSelected(const QStringList &names)
+{
+    selectedLocators = QSet<QString>(names.begin(), names.end());
+    selectedLocator = names.value(0);
+    refreshMarkers();
+    selectTreeLocator(selectedLocator);
+}
+
+void MainWindow::selectTreeLocator(const QString &name)
+{
+    // Only mirror the selection; switching to the add tool is left to clicks
+    // in the tree itself.
+    QSignalBlocker blocker(ui->MainTree);
+    ui->MainTree->setCurrentItem(nullptr);
+    if (name.isEmpty())
+        return;
+    QList<QTreeWidgetItem *> items = ui->MainTree->findItems(name, Qt::MatchExactly | Qt::MatchRecursive);
+    for (QTreeWidgetItem *it : items) {
+        if (it->parent() && it->parent()->text(0) == tr("Locators")) {
+            ui->MainTree->setCurrentItem(it);
+            break;
+        }
+    }
 }
 
 void MainWindow::onTreeSelectionChanged(QTreeWidgetItem *current, QTreeWidgetItem *)
@@ -466,9 +675,9 @@ void MainWindow::deleteSelectedLocator()
     }
     if (selectedLocator == name)
         selectedLocator.clear();
+    selectedLocators.remove(name);
+    viewer->removeMarker(name);
     updateTree();
-    if (currentIndex >= 0)
-        showImage(currentIndex, true);
 }
 
 
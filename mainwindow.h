@@ -7,6 +7,10 @@
 #include "amutilities.h"
 #include "camera_calibrator.h"
 #include <QTreeWidgetItem>
+#include <memory>
+
+class QProgressDialog;
+class QThread;
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -42,23 +46,45 @@ private slots:
     void onTreeSelectionChanged(QTreeWidgetItem *current, QTreeWidgetItem *previous);
     void deleteSelectedLocator();
     void exitLocatorMode();
+    void onMarkerPicked(const QString &name);
+    void onMarkerDragged(const QString &name, float x, float y);
+    void onMarkersSelected(const QStringList &names);
+    void onCalibrationProgress(const std::shared_ptr<CameraCalibrator> &calibrator,
+                               const CalibrationProgress &progress);
+    void onCalibrationFinished(bool ok);
 
 private:
     void showImage(int index, bool keepView = false);
+    QVector<QImage> loadImagesTimed(const QStringList &paths);
+    ViewerMarker markerFor(const LocatorData &l, int index) const;
+    void refreshMarkers();
+    void selectTreeLocator(const QString &name);
     QString getNextLocatorName() const;
     void updateTree();
+    CalibrationProfile calibrationProfile() const;
+    void setCalibrationProfile(CalibrationProfile profile);
 
     Ui::MainWindow *ui;
     ImageViewer *viewer;
     QStringList imagePaths;
     QVector<QImage> images;
     QList<LocatorData> locators;
-    QMap<int, double> imageErrors;
+    QVector<double> imageErrors;
+    // Calibrated cameras, from the last calibration or the loaded scene.
+    QList<CameraData> cameras;
+    // Locator name -> images where its click was rejected by the last
+    // calibration, with the click's reprojection error (infinite if unknown).
+    QHash<QString, QVector<QPair<int, double>>> outlierImages;
     QString selectedLocator;
+    QSet<QString> selectedLocators;
     QString sceneFilePath;
     bool locatorMode;
     int currentIndex;
     ToolController *m_toolController;
     AddLocatorTool *m_addLocatorTool;
+    SelectTool *m_selectTool;
+    std::shared_ptr<CameraCalibrator> m_calibrator;
+    QThread *m_calibrationThread;
+    QProgressDialog *m_calibrationDialog;
 };
 #endif // MAINWINDOW_H
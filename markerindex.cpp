@@ -0,0 +1,98 @@
+#include "markerindex.h"
+#include <limits>
+
+MarkerIndex::MarkerIndex(int cellsPerSide)
+    : m_side(qMax(1, cellsPerSide)),
+      m_cells(m_side * m_side)
+{
+}
+
+void MarkerIndex::clear()
+{
+    for (QVector<Entry> &cell : m_cells)
+        cell.clear();
+}
+
+int MarkerIndex::column(qreal x) const
+{
+    return qBound(0, int(x * m_side), m_side - 1);
+}
+
+int MarkerIndex::row(qreal y) const
+{
+    return qBound(0, int(y * m_side), m_side - 1);
+}
+
+void MarkerIndex::insert(int id, const QPointF &p)
+{
+    m_cells[row(p.y()) * m_side + column(p.x())].append(Entry{id, p});
+}
+
+void MarkerIndex::remove(int id, const QPointF &p)
+{
+    QVector<Entry> &cell = m_cells[row(p.y()) * m_side + column(p.x())];
+    for (int i = 0; i < cell.size(); ++i) {
+        if (cell[i].id == id) {
+            cell[i] = cell.last();
+            cell.removeLast();
+            return;
+        }
+    }
+}
+
+void MarkerIndex::move(int id, const QPointF &from, const QPointF &to)
+{
+    remove(id, from);
+    insert(id, to);
+}
+
+int MarkerIndex::nearest(const QPointF &p, const QSizeF &radius) const
+{
+    if (radius.width() <= 0 || radius.height() <= 0)
+        return -1;
+    const int c0 = column(p.x() - radius.width());
+    const int c1 = column(p.x() + radius.width());
+    const int r0 = row(p.y() - radius.height());
+    const int r1 = row(p.y() + radius.height());
+
+    int best = -1;
+    qreal bestDist = std::numeric_limits<qreal>::max();
+    for (int r = r0; r <= r1; ++r) {
+        for (int c = c0; c <= c1; ++c) {
+            for (const Entry &e : m_cells[r * m_side + c]) {
+                const qreal dx = (e.pos.x() - p.x()) / radius.width();
+                const qreal dy = (e.pos.y() - p.y()) / radius.height();
+                const qreal d = dx * dx + dy * dy;
+                if (d <= 1.0 && d < bestDist) {
+                    bestDist = d;
+                    best = e.id;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+QVector<int> MarkerIndex::inRect(const QRectF &r) const
+{
+    QVector<int> ids;
+    const QRectF n = r.normalized();
+    if (n.right() < 0 || n.bottom() < 0 || n.left() > 1 || n.top() > 1)
+        return ids;
+    const int c0 = column(n.left());
+    const int c1 = column(n.right());
+    const int r0 = row(n.top());
+    const int r1 = row(n.bottom());
+    for (int y = r0; y <= r1; ++y) {
+        for (int x = c0; x <= c1; ++x) {
+            const QVector<Entry> &cell = m_cells[y * m_side + x];
+            // Interior cells are fully covered, only border cells need a test.
+            const bool border = y == r0 || y == r1 || x == c0 || x == c1;
+            for (const Entry &e : cell) {
+                if (!border || n.contains(e.pos))
+                    ids.append(e.id);
+            }
+        }
+    }
+    return ids;
+}
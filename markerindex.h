@@ -0,0 +1,39 @@
+#ifndef MARKERINDEX_H
+#define MARKERINDEX_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QSizeF>
+#include <QVector>
+
+// Uniform grid over normalized image coordinates ([0, 1] x [0, 1]). Maps
+// marker slots to their positions so picking and rectangle queries only
+// visit the cells around the query instead of every marker.
+class MarkerIndex
+{
+public:
+    explicit MarkerIndex(int cellsPerSide = 64);
+
+    void clear();
+    void insert(int id, const QPointF &p);
+    void remove(int id, const QPointF &p);
+    void move(int id, const QPointF &from, const QPointF &to);
+
+    // Closest entry inside the ellipse with the given radii, or -1.
+    int nearest(const QPointF &p, const QSizeF &radius) const;
+    QVector<int> inRect(const QRectF &r) const;
+
+private:
+    struct Entry {
+        int id;
+        QPointF pos;
+    };
+
+    int column(qreal x) const;
+    int row(qreal y) const;
+
+    int m_side;
+    QVector<QVector<Entry>> m_cells;
+};
+
+#endif // MARKERINDEX_H
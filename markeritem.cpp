@@ -0,0 +1,295 @@
+#include "markeritem.h"
+#include "amutilities.h"
+#include "viewerstats.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QFontMetricsF>
+#include <QBitArray>
+#include <cmath>
+
+// Sizes are in device pixels, like the old ItemIgnoresTransformations items.
+static const qreal kCrossHalfSize = 5.0;
+static const QPointF kLabelOffset(6.0, -6.0);
+static const qreal kBoundsMargin = 64.0;
+static const qreal kDefaultLabelZoomThreshold = 0.1;
+static const int kLabelCellSize = 8;
+static const int kCrossCellSize = 3;
+
+namespace {
+
+// Occupancy grid over the painted device area. Used to drop crosses and
+// labels that would land on top of something already drawn, which bounds
+// the work per frame by the visible screen area.
+class ScreenGrid
+{
+public:
+    ScreenGrid(const QRect &area, int cellSize)
+        : m_area(area),
+          m_cell(cellSize),
+          m_cols(area.width() / cellSize + 1),
+          m_rows(area.height() / cellSize + 1),
+          m_bits(m_cols * m_rows)
+    {
+    }
+
+    // Marks the cells covered by r. Returns false and marks nothing when any
+    // of them is already taken or r lies outside the area.
+    bool tryOccupy(const QRectF &r)
+    {
+        int c0 = qMax(0, int((r.left() - m_area.left()) / m_cell));
+        int r0 = qMax(0, int((r.top() - m_area.top()) / m_cell));
+        int c1 = qMin(m_cols - 1, int((r.right() - m_area.left()) / m_cell));
+        int r1 = qMin(m_rows - 1, int((r.bottom() - m_area.top()) / m_cell));
+        if (c0 > c1 || r0 > r1)
+            return false;
+        for (int y = r0; y <= r1; ++y)
+            for (int x = c0; x <= c1; ++x)
+                if (m_bits.testBit(y * m_cols + x))
+                    return false;
+        for (int y = r0; y <= r1; ++y)
+            for (int x = c0; x <= c1; ++x)
+                m_bits.setBit(y * m_cols + x);
+        return true;
+    }
+
+private:
+    QRect m_area;
+    int m_cell;
+    int m_cols;
+    int m_rows;
+    QBitArray m_bits;
+};
+
+} // namespace
+
+MarkerItem::MarkerItem(QGraphicsItem *parent)
+    : QGraphicsItem(parent),
+      m_deviceScale(1.0),
+      m_labelZoomThreshold(kDefaultLabelZoomThreshold),
+      m_stats(nullptr)
+{
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+void MarkerItem::setImageSize(const QSizeF &size)
+{
+    if (size == m_imageSize)
+        return;
+    prepareGeometryChange();
+    m_imageSize = size;
+}
+
+void MarkerItem::setLabelZoomThreshold(qreal deviceScale)
+{
+    m_labelZoomThreshold = deviceScale;
+    update();
+}
+
+MarkerItem::Label MarkerItem::makeLabel(const QString &name) const
+{
+    Label l;
+    l.text.setText(name);
+    l.text.setPerformanceHint(QStaticText::AggressiveCaching);
+    return l;
+}
+
+void MarkerItem::setMarkers(const QList<ViewerMarker> &markers)
+{
+    // Keep the glyph runs of labels that are still present.
+    QHash<QString, Label> oldLabels;
+    for (auto it = m_indexByName.cbegin(); it != m_indexByName.cend(); ++it)
+        oldLabels.insert(it.key(), m_labels[it.value()]);
+
+    m_markers.clear();
+    m_labels.clear();
+    m_indexByName.clear();
+    m_index.clear();
+    m_markers.reserve(markers.size());
+    m_labels.reserve(markers.size());
+    for (const ViewerMarker &m : markers) {
+        m_indexByName.insert(m.name, m_markers.size());
+        m_index.insert(m_markers.size(), QPointF(m.x, m.y));
+        m_markers.append(m);
+        auto old = oldLabels.constFind(m.name);
+        m_labels.append(old != oldLabels.constEnd() ? old.value() : makeLabel(m.name));
+    }
+    update();
+}
+
+void MarkerItem::updateMarker(const ViewerMarker &marker)
+{
+    auto it = m_indexByName.constFind(marker.name);
+    if (it == m_indexByName.constEnd()) {
+        m_indexByName.insert(marker.name, m_markers.size());
+        m_index.insert(m_markers.size(), QPointF(marker.x, marker.y));
+        m_markers.append(marker);
+        m_labels.append(makeLabel(marker.name));
+    } else {
+        ViewerMarker &old = m_markers[it.value()];
+        update(dirtyRect(old));
+        m_index.move(it.value(), QPointF(old.x, old.y), QPointF(marker.x, marker.y));
+        old = marker;
+    }
+    update(dirtyRect(marker));
+}
+
+void MarkerItem::removeMarker(const QString &name)
+{
+    auto it = m_indexByName.find(name);
+    if (it == m_indexByName.end())
+        return;
+    const int idx = it.value();
+    m_indexByName.erase(it);
+    update(dirtyRect(m_markers[idx]));
+    m_index.remove(idx, QPointF(m_markers[idx].x, m_markers[idx].y));
+    if (m_hovered == name)
+        m_hovered.clear();
+
+    // Swap with the last entry so removal stays O(1).
+    const int last = m_markers.size() - 1;
+    if (idx != last) {
+        const ViewerMarker &moved = m_markers[last];
+        m_index.remove(last, QPointF(moved.x, moved.y));
+        m_index.insert(idx, QPointF(moved.x, moved.y));
+        m_markers[idx] = moved;
+        m_labels[idx] = m_labels[last];
+        m_indexByName[m_markers[idx].name] = idx;
+    }
+    m_markers.removeLast();
+    m_labels.removeLast();
+}
+
+QPointF MarkerItem::normalized(const QPointF &pos) const
+{
+    if (m_imageSize.isEmpty())
+        return QPointF();
+    return QPointF(pos.x() / m_imageSize.width(), pos.y() / m_imageSize.height());
+}
+
+QString MarkerItem::markerAt(const QPointF &pos, qreal radius) const
+{
+    if (m_imageSize.isEmpty())
+        return QString();
+    const qreal r = radius / m_deviceScale;
+    const int idx = m_index.nearest(normalized(pos),
+                                    QSizeF(r / m_imageSize.width(), r / m_imageSize.height()));
+    return idx < 0 ? QString() : m_markers[idx].name;
+}
+
+QStringList MarkerItem::markersIn(const QRectF &rect) const
+{
+    QStringList names;
+    if (m_imageSize.isEmpty())
+        return names;
+    const QRectF n(normalized(rect.topLeft()), normalized(rect.bottomRight()));
+    for (int idx : m_index.inRect(n))
+        names << m_markers[idx].name;
+    return names;
+}
+
+void MarkerItem::setHoveredMarker(const QString &name)
+{
+    if (name == m_hovered)
+        return;
+    auto old = m_indexByName.constFind(m_hovered);
+    if (old != m_indexByName.constEnd())
+        update(dirtyRect(m_markers[old.value()]));
+    m_hovered = name;
+    auto cur = m_indexByName.constFind(m_hovered);
+    if (cur != m_indexByName.constEnd())
+        update(dirtyRect(m_markers[cur.value()]));
+}
+
+QRectF MarkerItem::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), m_imageSize)
+        .adjusted(-kBoundsMargin, -kBoundsMargin, kBoundsMargin, kBoundsMargin);
+}
+
+QPointF MarkerItem::scenePos(const ViewerMarker &m) const
+{
+    return QPointF(m.x * m_imageSize.width(), m.y * m_imageSize.height());
+}
+
+QRectF MarkerItem::dirtyRect(const ViewerMarker &m) const
+{
+    // Cross and label are drawn at a fixed device size, so the dirty area in
+    // item coordinates depends on the scale of the last paint.
+    QFontMetricsF fm(m_font);
+    QRectF device(-kCrossHalfSize - 2, kLabelOffset.y() - 2,
+                  kCrossHalfSize + kLabelOffset.x() + fm.horizontalAdvance(m.name) + 4,
+                  -kLabelOffset.y() + qMax(kCrossHalfSize, fm.height()) + 4);
+    const qreal s = 1.0 / m_deviceScale;
+    return QRectF(scenePos(m) + device.topLeft() * s, device.size() * s);
+}
+
+void MarkerItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                       QWidget *)
+{
+    if (m_markers.isEmpty())
+        return;
+
+    const QTransform world = painter->worldTransform();
+    m_deviceScale = qMax<qreal>(1e-6, std::sqrt(qAbs(world.determinant())));
+    const qreal margin = (kBoundsMargin + kCrossHalfSize) / m_deviceScale;
+    const QRectF exposed = option->exposedRect.adjusted(-margin, -margin, margin, margin);
+    const bool drawLabels = m_deviceScale >= m_labelZoomThreshold;
+
+    painter->save();
+    painter->resetTransform();
+    painter->setFont(m_font);
+
+    const QRect area = painter->viewport();
+    ScreenGrid crossGrid(area, kCrossCellSize);
+    ScreenGrid labelGrid(area, kLabelCellSize);
+    QVector<int> labelOrder;
+    QVector<QPointF> labelPos;
+    int firstPlain = 0;
+
+    QPen pen;
+    pen.setCosmetic(true);
+    const QRectF visible(normalized(exposed.topLeft()), normalized(exposed.bottomRight()));
+    for (int i : m_index.inRect(visible)) {
+        const ViewerMarker &m = m_markers[i];
+        const bool emphasized = m.highlight || m.name == m_hovered;
+        const QPointF dp = world.map(scenePos(m));
+        if (!emphasized && !crossGrid.tryOccupy(QRectF(dp, QSizeF(0, 0))))
+            continue;
+
+        pen.setColor(errorToColor(m.error));
+        pen.setWidth(m.name == m_hovered ? 3 : (m.highlight ? 2 : 1));
+        painter->setPen(pen);
+        painter->drawLine(QPointF(dp.x() - kCrossHalfSize, dp.y()),
+                          QPointF(dp.x() + kCrossHalfSize, dp.y()));
+        painter->drawLine(QPointF(dp.x(), dp.y() - kCrossHalfSize),
+                          QPointF(dp.x(), dp.y() + kCrossHalfSize));
+
+        if (!drawLabels && !emphasized)
+            continue;
+        // Highlighted labels go first so they win the overlap test.
+        if (emphasized) {
+            labelOrder.insert(firstPlain, i);
+            labelPos.insert(firstPlain, dp);
+            ++firstPlain;
+        } else {
+            labelOrder.append(i);
+            labelPos.append(dp);
+        }
+    }
+
+    painter->setPen(Qt::black);
+    for (int k = 0; k < labelOrder.size(); ++k) {
+        Label &label = m_labels[labelOrder[k]];
+        if (m_stats)
+            m_stats->recordCacheAccess(ViewerStats::LabelCache, label.prepared);
+        if (!label.prepared) {
+            label.text.prepare(QTransform(), m_font);
+            label.prepared = true;
+        }
+        const QPointF topLeft = labelPos[k] + kLabelOffset;
+        if (!labelGrid.tryOccupy(QRectF(topLeft, label.text.size())) && k >= firstPlain)
+            continue;
+        painter->drawStaticText(topLeft, label.text);
+    }
+    painter->restore();
+}
@@ -0,0 +1,78 @@
+#ifndef MARKERITEM_H
+#define MARKERITEM_H
+
+#include <QGraphicsItem>
+#include <QFont>
+#include <QHash>
+#include <QList>
+#include <QSizeF>
+#include <QStaticText>
+#include <QStringList>
+#include <QVector>
+#include "markerindex.h"
+
+class ViewerStats;
+
+struct ViewerMarker {
+    float x;
+    float y;
+    QString name;
+    float error = 0.0f;
+    bool highlight = false;
+};
+
+// Draws every locator cross and label of the current image in a single
+// paint() call. Markers are kept in a flat array in normalized image
+// coordinates and can be added, moved or removed one at a time.
+class MarkerItem : public QGraphicsItem
+{
+public:
+    explicit MarkerItem(QGraphicsItem *parent = nullptr);
+
+    void setImageSize(const QSizeF &size);
+    void setMarkers(const QList<ViewerMarker> &markers);
+    void updateMarker(const ViewerMarker &marker);
+    void removeMarker(const QString &name);
+    int markerCount() const { return m_markers.size(); }
+    void setStats(ViewerStats *stats) { m_stats = stats; }
+
+    // Labels are hidden when the image is shown smaller than this many
+    // device pixels per image pixel. Highlighted labels are always drawn.
+    void setLabelZoomThreshold(qreal deviceScale);
+    qreal labelZoomThreshold() const { return m_labelZoomThreshold; }
+
+    // Picking helpers; positions are in item (image pixel) coordinates and
+    // the radius is in device pixels.
+    QString markerAt(const QPointF &pos, qreal radius) const;
+    QStringList markersIn(const QRectF &rect) const;
+    void setHoveredMarker(const QString &name);
+    QString hoveredMarker() const { return m_hovered; }
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget = nullptr) override;
+
+private:
+    struct Label {
+        QStaticText text;
+        bool prepared = false;
+    };
+
+    Label makeLabel(const QString &name) const;
+    QPointF scenePos(const ViewerMarker &m) const;
+    QPointF normalized(const QPointF &pos) const;
+    QRectF dirtyRect(const ViewerMarker &m) const;
+
+    QSizeF m_imageSize;
+    QVector<ViewerMarker> m_markers;
+    QVector<Label> m_labels;
+    QHash<QString, int> m_indexByName;
+    MarkerIndex m_index;
+    QString m_hovered;
+    QFont m_font;
+    qreal m_deviceScale;
+    qreal m_labelZoomThreshold;
+    ViewerStats *m_stats;
+};
+
+#endif // MARKERITEM_H
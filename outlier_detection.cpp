@@ -0,0 +1,226 @@
+#include "outlier_detection.h"
+#include "parallel_for.h"
+
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <colmap/estimators/two_view_geometry.h>
+
+using namespace colmap;
+
+// Fewer shared locators leave RANSAC no redundancy to find outliers with.
+static const size_t kMinPairLocators = 8;
+static const size_t kMaxHypotheses = 100;
+
+namespace {
+
+struct PairCheck {
+  int image1;
+  int image2;
+  std::vector<int> locators;
+  // Empty when the pair could not be checked.
+  std::vector<char> inliers;
+};
+
+} // namespace
+
+QVector<LocatorObservation>
+findEpipolarOutliers(const QMap<int, QMap<int, QPointF>> &tracks,
+                     const std::vector<Camera> &cameras,
+                     double maxError, int numThreads) {
+  const int numImages = static_cast<int>(cameras.size());
+  std::map<std::pair<int, int>, std::vector<int>> pairLocators;
+  for (auto it = tracks.cbegin(); it != tracks.cend(); ++it) {
+    const QList<int> images = it.value().keys();
+    for (int a = 0; a < images.size(); ++a) {
+      for (int b = a + 1; b < images.size(); ++b) {
+        if (images[a] >= 0 && images[b] < numImages)
+          pairLocators[{images[a], images[b]}].push_back(it.key());
+      }
+    }
+  }
+  std::vector<PairCheck> pairs;
+  for (auto &entry : pairLocators) {
+    if (entry.second.size() >= kMinPairLocators)
+      pairs.push_back({entry.first.first, entry.first.second,
+                       std::move(entry.second), {}});
+  }
+
+  TwoViewGeometryOptions options;
+  options.min_num_inliers = 5;
+  options.ransac_options.max_error = maxError;
+  parallelFor(static_cast<int>(pairs.size()), [&](int p) {
+    PairCheck &pair = pairs[p];
+    std::vector<Eigen::Vector2d> points1;
+    std::vector<Eigen::Vector2d> points2;
+    FeatureMatches matches;
+    for (size_t k = 0; k < pair.locators.size(); ++k) {
+      const QMap<int, QPointF> obs = tracks.value(pair.locators[k]);
+      const QPointF p1 = obs.value(pair.image1);
+      const QPointF p2 = obs.value(pair.image2);
+      points1.emplace_back(p1.x(), p1.y());
+      points2.emplace_back(p2.x(), p2.y());
+      matches.emplace_back(k, k);
+    }
+    // A guessed focal length would bend the essential matrix enough to
+    // vote out good clicks, so without priors the fundamental matrix is
+    // fitted instead.
+    const Camera &camera1 = cameras[pair.image1];
+    const Camera &camera2 = cameras[pair.image2];
+    const TwoViewGeometry geometry =
+        camera1.has_prior_focal_length && camera2.has_prior_focal_length
+            ? EstimateCalibratedTwoViewGeometry(camera1, points1, camera2,
+                                                points2, matches, options)
+            : EstimateUncalibratedTwoViewGeometry(camera1, points1, camera2,
+                                                  points2, matches, options);
+    if (geometry.inlier_matches.empty())
+      return;
+    pair.inliers.assign(pair.locators.size(), 0);
+    for (const FeatureMatch &match : geometry.inlier_matches)
+      pair.inliers[match.point2D_idx1] = 1;
+  }, 4, numThreads);
+
+  // (failed pairs, checked pairs) per observation.
+  std::map<std::pair<int, int>, std::pair<int, int>> votes;
+  for (const PairCheck &pair : pairs) {
+    if (pair.inliers.empty())
+      continue;
+    for (size_t k = 0; k < pair.locators.size(); ++k) {
+      const int failed = pair.inliers[k] ? 0 : 1;
+      for (int image : {pair.image1, pair.image2}) {
+        std::pair<int, int> &vote = votes[{pair.locators[k], image}];
+        vote.first += failed;
+        vote.second += 1;
+      }
+    }
+  }
+  QVector<LocatorObservation> outliers;
+  for (const auto &entry : votes) {
+    const std::pair<int, int> &vote = entry.second;
+    if (vote.first >= 2 && vote.first * 2 > vote.second)
+      outliers.append({entry.first.first, entry.first.second});
+  }
+  return outliers;
+}
+
+// Reprojects X and tells whether it lands within maxError pixels of the
+// click, in front of the camera.
+static bool reprojects(const ProjectionMatrix &P, const Eigen::Vector3d &X,
+                       const QPointF &click, double maxError) {
+  Eigen::Vector4d Xh;
+  Xh << X, 1.0;
+  const Eigen::Vector3d proj = P * Xh;
+  if (proj(2) <= 0)
+    return false;
+  const double dx = proj(0) / proj(2) - click.x();
+  const double dy = proj(1) / proj(2) - click.y();
+  return dx * dx + dy * dy <= maxError * maxError;
+}
+
+QVector<LocatorObservation>
+findTriangulationOutliers(const QMap<int, QMap<int, QPointF>> &tracks,
+                          const ProjectionTable &projections,
+                          double maxError, int numThreads) {
+  std::vector<int> locators;
+  std::vector<const QMap<int, QPointF> *> observations;
+  for (auto it = tracks.cbegin(); it != tracks.cend(); ++it) {
+    locators.push_back(it.key());
+    observations.push_back(&it.value());
+  }
+  std::vector<std::vector<int>> rejected(locators.size());
+
+  parallelFor(static_cast<int>(locators.size()), [&](int t) {
+    std::vector<int> images;
+    std::vector<QPointF> clicks;
+    for (auto it = observations[t]->cbegin(); it != observations[t]->cend();
+         ++it) {
+      if (projections.contains(it.key())) {
+        images.push_back(it.key());
+        clicks.push_back(it.value());
+      }
+    }
+    const size_t n = images.size();
+    if (n < 3)
+      return;
+
+    // Every view pair for short tracks, a seeded sample for long ones.
+    std::vector<std::pair<size_t, size_t>> hypotheses;
+    if (n * (n - 1) / 2 <= kMaxHypotheses) {
+      for (size_t a = 0; a < n; ++a)
+        for (size_t b = a + 1; b < n; ++b)
+          hypotheses.emplace_back(a, b);
+    } else {
+      std::mt19937 rng(static_cast<unsigned>(locators[t]));
+      std::uniform_int_distribution<size_t> pick(0, n - 1);
+      while (hypotheses.size() < kMaxHypotheses) {
+        const size_t a = pick(rng);
+        const size_t b = pick(rng);
+        if (a != b)
+          hypotheses.emplace_back(a, b);
+      }
+    }
+
+    std::vector<char> bestInliers;
+    size_t bestCount = 0;
+    std::vector<char> inliers(n);
+    for (const auto &h : hypotheses) {
+      LinearTriangulator triangulator;
+      triangulator.addView(projections[images[h.first]], clicks[h.first].x(),
+                           clicks[h.first].y());
+      triangulator.addView(projections[images[h.second]],
+                           clicks[h.second].x(), clicks[h.second].y());
+      Eigen::Vector3d X;
+      if (!triangulator.solve(&X))
+        continue;
+      size_t count = 0;
+      for (size_t k = 0; k < n; ++k) {
+        inliers[k] = reprojects(projections[images[k]], X, clicks[k], maxError);
+        count += inliers[k];
+      }
+      if (count > bestCount) {
+        bestCount = count;
+        bestInliers = inliers;
+      }
+    }
+    if (bestCount < 2 || bestCount * 2 <= n || bestCount == n)
+      return;
+
+    // Refit on the consensus and reject what still does not agree.
+    LinearTriangulator triangulator;
+    for (size_t k = 0; k < n; ++k) {
+      if (bestInliers[k])
+        triangulator.addView(projections[images[k]], clicks[k].x(),
+                             clicks[k].y());
+    }
+    Eigen::Vector3d X;
+    if (!triangulator.solve(&X))
+      return;
+    for (size_t k = 0; k < n; ++k) {
+      if (!reprojects(projections[images[k]], X, clicks[k], maxError))
+        rejected[t].push_back(images[k]);
+    }
+    if (rejected[t].size() * 2 >= n)
+      rejected[t].clear();
+  }, 16, numThreads);
+
+  QVector<LocatorObservation> outliers;
+  for (size_t t = 0; t < locators.size(); ++t) {
+    for (int image : rejected[t])
+      outliers.append({locators[t], image});
+  }
+  return outliers;
+}
+
+void removeObservations(QMap<int, QMap<int, QPointF>> *tracks,
+                        const QVector<LocatorObservation> &observations) {
+  for (const LocatorObservation &obs : observations) {
+    auto track = tracks->find(obs.locator);
+    if (track == tracks->end())
+      continue;
+    track.value().remove(obs.image);
+    if (track.value().isEmpty())
+      tracks->erase(track);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef OUTLIER_DETECTION_H
+#define OUTLIER_DETECTION_H
+
+#include "triangulation.h"
+
+#include <QMap>
+#include <QPair>
+#include <QPointF>
+#include <QVector>
+
+#include <vector>
+
+#include <colmap/scene/camera.h>
+
+// One click of a locator in one image.
+struct LocatorObservation {
+  int locator;
+  int image;
+};
+
+// Pose-free check run before the solve. Every image pair sharing enough
+// locators gets an essential matrix fitted with RANSAC when both cameras
+// have a focal length prior, and a fundamental matrix otherwise. cameras
+// is indexed like the images. An observation is rejected when
+// it is an outlier in at least two of the pairs it takes part in and in
+// more than half of them; a bad click fails all of its pairs while the
+// other end of each match only fails one.
+QVector<LocatorObservation>
+findEpipolarOutliers(const QMap<int, QMap<int, QPointF>> &tracks,
+                     const std::vector<colmap::Camera> &cameras,
+                     double maxError, int numThreads = 0);
+
+// Check against solved cameras. For every locator seen by at least three
+// posed images, each pair of views proposes a point by triangulation. The
+// point that most views reproject to within maxError pixels wins, and the
+// remaining views are rejected when they are a minority.
+//
+// Both checks run on up to numThreads threads, all cores when it is not
+// positive.
+QVector<LocatorObservation>
+findTriangulationOutliers(const QMap<int, QMap<int, QPointF>> &tracks,
+                          const ProjectionTable &projections, double maxError,
+                          int numThreads = 0);
+
+void removeObservations(QMap<int, QMap<int, QPointF>> *tracks,
+                        const QVector<LocatorObservation> &observations);
+
+#endif // OUTLIER_DETECTION_H
@@ -0,0 +1,40 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Calls fn(i) for every i in [0, count) on up to maxThreads threads, or
+// hardware_concurrency() when maxThreads is not positive, one contiguous
+// chunk per thread. Ranges shorter than two chunks run inline on the
+// calling thread. fn must be safe to call concurrently for different i.
+template <typename Fn>
+void parallelFor(int count, Fn &&fn, int minChunk = 64, int maxThreads = 0) {
+  const int hw = maxThreads > 0
+                     ? maxThreads
+                     : std::max(1, static_cast<int>(
+                                       std::thread::hardware_concurrency()));
+  const int numThreads =
+      std::min(hw, (count + minChunk - 1) / std::max(1, minChunk));
+  if (numThreads <= 1) {
+    for (int i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+  const int chunk = (count + numThreads - 1) / numThreads;
+  auto run = [&](int begin) {
+    const int end = std::min(count, begin + chunk);
+    for (int i = begin; i < end; ++i)
+      fn(i);
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (int t = 1; t < numThreads; ++t)
+    threads.emplace_back(run, t * chunk);
+  run(0);
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+#endif // PARALLEL_FOR_H
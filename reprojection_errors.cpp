@@ -0,0 +1,117 @@
+#include "reprojection_errors.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+ReprojectionErrors
+computeReprojectionErrors(const QMap<int, QMap<int, QPointF>> &tracks,
+                          const ProjectionTable &projections, int numImages,
+                          const QMap<int, QMap<int, QPointF>> &rejected,
+                          int numThreads) {
+  const double inf = std::numeric_limits<double>::infinity();
+  const QMap<int, QPointF> none;
+  ReprojectionErrors result;
+  result.perImage.fill(inf, numImages);
+  int numLocators = tracks.isEmpty() ? 0 : tracks.lastKey() + 1;
+  if (!rejected.isEmpty())
+    numLocators = std::max(numLocators, rejected.lastKey() + 1);
+  result.perLocator.fill(inf, numLocators);
+
+  // Observation slots are laid out up front so every locator fills its own
+  // range without synchronization.
+  std::vector<int> setIds;
+  std::vector<const QMap<int, QPointF> *> observations;
+  std::vector<const QMap<int, QPointF> *> rejections;
+  std::vector<int> offsets(1, 0);
+  auto posedCount = [&](const QMap<int, QPointF> &obs) {
+    int posed = 0;
+    for (auto it = obs.cbegin(); it != obs.cend(); ++it) {
+      if (projections.contains(it.key()))
+        ++posed;
+    }
+    return posed;
+  };
+  auto track = tracks.cbegin();
+  auto rejection = rejected.cbegin();
+  while (track != tracks.cend() || rejection != rejected.cend()) {
+    const bool hasTrack =
+        track != tracks.cend() &&
+        (rejection == rejected.cend() || track.key() <= rejection.key());
+    const bool hasRejection =
+        rejection != rejected.cend() &&
+        (track == tracks.cend() || rejection.key() <= track.key());
+    setIds.push_back(hasTrack ? track.key() : rejection.key());
+    observations.push_back(hasTrack ? &track.value() : &none);
+    rejections.push_back(hasRejection ? &rejection.value() : &none);
+    offsets.push_back(offsets.back() + posedCount(*observations.back()) +
+                      posedCount(*rejections.back()));
+    if (hasTrack)
+      ++track;
+    if (hasRejection)
+      ++rejection;
+  }
+  const int numObservations = offsets.back();
+  result.observationLocators.resize(numObservations);
+  result.observationImages.resize(numObservations);
+  result.observationErrors.resize(numObservations);
+  result.observationRejected.resize(numObservations);
+
+  int *obsLocators = result.observationLocators.data();
+  int *obsImages = result.observationImages.data();
+  double *obsErrors = result.observationErrors.data();
+  bool *obsRejected = result.observationRejected.data();
+  double *perLocator = result.perLocator.data();
+  parallelFor(static_cast<int>(setIds.size()), [&](int i) {
+    Eigen::Vector3d X;
+    const bool valid = triangulatePoint(*observations[i], projections, &X);
+    Eigen::Vector4d Xh;
+    Xh << X, 1.0;
+    double total = 0.0;
+    int kept = 0;
+    int slot = offsets[i];
+    auto measure = [&](const QMap<int, QPointF> &obs, bool isRejected) {
+      for (auto it = obs.cbegin(); it != obs.cend(); ++it) {
+        const int idx = it.key();
+        if (!projections.contains(idx))
+          continue;
+        double err = inf;
+        if (valid) {
+          Eigen::Vector3d proj = projections[idx] * Xh;
+          proj /= proj(2);
+          err = std::hypot(it.value().x() - proj(0), it.value().y() - proj(1));
+        }
+        obsLocators[slot] = setIds[i];
+        obsImages[slot] = idx;
+        obsErrors[slot] = err;
+        obsRejected[slot] = isRejected;
+        if (!isRejected) {
+          total += err;
+          ++kept;
+        }
+        ++slot;
+      }
+    };
+    measure(*observations[i], false);
+    measure(*rejections[i], true);
+    if (valid && kept > 0)
+      perLocator[setIds[i]] = total / kept;
+  }, 64, numThreads);
+
+  std::vector<double> totals(numImages, 0.0);
+  std::vector<int> counts(numImages, 0);
+  for (int k = 0; k < numObservations; ++k) {
+    const int idx = obsImages[k];
+    if (idx >= numImages || obsRejected[k] || !std::isfinite(obsErrors[k]))
+      continue;
+    totals[idx] += obsErrors[k];
+    ++counts[idx];
+  }
+  for (int idx = 0; idx < numImages; ++idx) {
+    if (counts[idx])
+      result.perImage[idx] = totals[idx] / counts[idx];
+  }
+  return result;
+}
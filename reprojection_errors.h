@@ -0,0 +1,37 @@
+#ifndef REPROJECTION_ERRORS_H
+#define REPROJECTION_ERRORS_H
+
+#include "triangulation.h"
+
+#include <QMap>
+#include <QPointF>
+#include <QVector>
+
+// Reprojection residuals of every locator observation, from a single
+// triangulation per locator. Means are infinity where nothing could be
+// measured: images without a pose or without triangulated locators, and
+// locators that could not be triangulated.
+struct ReprojectionErrors {
+  // Mean error in pixels by image index and by locator id.
+  QVector<double> perImage;
+  QVector<double> perLocator;
+  // One entry per observation in a posed image, grouped by locator.
+  // Rejected observations are measured against the point triangulated from
+  // the kept ones and stay out of the means.
+  QVector<int> observationLocators;
+  QVector<int> observationImages;
+  QVector<double> observationErrors;
+  QVector<bool> observationRejected;
+};
+
+// Triangulates and measures all locators in one parallel pass on up to
+// numThreads threads, all cores when it is not positive. tracks maps
+// locator ids to pixel observations by image index; rejected holds clicks
+// the calibrator left out, in the same layout.
+ReprojectionErrors
+computeReprojectionErrors(const QMap<int, QMap<int, QPointF>> &tracks,
+                          const ProjectionTable &projections, int numImages,
+                          const QMap<int, QMap<int, QPointF>> &rejected = {},
+                          int numThreads = 0);
+
+#endif // REPROJECTION_ERRORS_H
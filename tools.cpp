@@ -1,6 +1,11 @@
 #include "tools.h"
 #include "imageviewer.h"
 #include "mainwindow.h"
+#include <QApplication>
+#include <QRubberBand>
+
+// Picking radius around a marker, in device pixels.
+static const qreal kPickRadius = 8.0;
 
 ToolController::ToolController(ImageViewer *viewer, QObject *parent)
     : QObject(parent), m_viewer(viewer), m_currentTool(nullptr), m_activeType(ToolType::None)
@@ -85,6 +90,82 @@ void AddLocatorTool::onExit()
         viewer()->unsetCursor();
 }
 
+// === SelectTool ===
+
+void SelectTool::onMousePress(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton || !viewer())
+        return;
+    QPointF pos = viewer()->mapToScene(event->pos());
+    QString name = viewer()->markerAt(pos, kPickRadius);
+    m_pressPos = event->pos();
+    if (!name.isEmpty()) {
+        m_dragName = name;
+        m_dragging = false;
+        emit markerPicked(name);
+    } else {
+        if (!m_band)
+            m_band = new QRubberBand(QRubberBand::Rectangle, viewer()->viewport());
+        m_band->setGeometry(QRect(m_pressPos, QSize()));
+        m_band->show();
+    }
+    event->accept();
+}
+
+void SelectTool::onMouseMove(QMouseEvent *event)
+{
+    if (!viewer())
+        return;
+    if (!m_dragName.isEmpty()) {
+        // A click with some hand jitter only picks the marker; it moves once
+        // the cursor has clearly left the press position.
+        if (!m_dragging
+            && (event->pos() - m_pressPos).manhattanLength() < QApplication::startDragDistance()) {
+            event->accept();
+            return;
+        }
+        m_dragging = true;
+        QPointF pos = viewer()->mapToScene(event->pos());
+        QRectF rect = viewer()->sceneRect();
+        if (rect.width() <= 0 || rect.height() <= 0)
+            return;
+        emit markerDragged(m_dragName, pos.x() / rect.width(), pos.y() / rect.height());
+        event->accept();
+    } else if (m_band && m_band->isVisible()) {
+        m_band->setGeometry(QRect(m_pressPos, event->pos()).normalized());
+        event->accept();
+    } else if (event->buttons() == Qt::NoButton) {
+        QPointF pos = viewer()->mapToScene(event->pos());
+        viewer()->setHoveredMarker(viewer()->markerAt(pos, kPickRadius));
+    }
+}
+
+void SelectTool::onMouseRelease(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton || !viewer())
+        return;
+    if (!m_dragName.isEmpty()) {
+        m_dragName.clear();
+        m_dragging = false;
+        event->accept();
+    } else if (m_band && m_band->isVisible()) {
+        m_band->hide();
+        QRect r = QRect(m_pressPos, event->pos()).normalized();
+        QRectF sceneRect = viewer()->mapToScene(r).boundingRect();
+        emit markersSelected(viewer()->markersIn(sceneRect));
+        event->accept();
+    }
+}
+
+void SelectTool::onExit()
+{
+    m_dragName.clear();
+    m_dragging = false;
+    if (m_band)
+        m_band->hide();
+    if (viewer())
+        viewer()->setHoveredMarker(QString());
+}
 
 // === DefineMeasurementsTool (placeholder) ===
 
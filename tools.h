@@ -4,11 +4,14 @@
 #include <QObject>
 #include <QMouseEvent>
 #include <QHash>
+#include <QStringList>
 
 class ImageViewer;
+class QRubberBand;
 
 enum class ToolType {
     None,
+    Select,
     AddLocator,
     DefineMeasurements,
     DefineWorldspace
@@ -69,6 +72,29 @@ signals:
     void locatorCreated(float x, float y);
 };
 
+class SelectTool : public ITool
+{
+    Q_OBJECT
+public:
+    using ITool::ITool;
+    void onMousePress(QMouseEvent *event) override;
+    void onMouseMove(QMouseEvent *event) override;
+    void onMouseRelease(QMouseEvent *event) override;
+    void onExit() override;
+
+signals:
+    void markerPicked(const QString &name);
+    void markerDragged(const QString &name, float x, float y);
+    void markersSelected(const QStringList &names);
+
+private:
+    QString m_dragName;
+    bool m_dragging = false;
+    QRubberBand *m_band = nullptr;
+    // Press position in viewport coordinates; origin of drags and the band.
+    QPoint m_pressPos;
+};
+
 class DefineMeasurementsTool : public ITool
 {
     Q_OBJECT
@@ -0,0 +1,91 @@
+#include "triangulation.h"
+#include "parallel_for.h"
+
+#include <Eigen/Eigenvalues>
+
+#include <cmath>
+
+ProjectionMatrix makeProjectionMatrix(const Eigen::Matrix3d &K,
+                                      const Eigen::Matrix3d &Rwc,
+                                      const Eigen::Vector3d &twc) {
+  const Eigen::Matrix3d Rcw = Rwc.transpose();
+  ProjectionMatrix P;
+  P.leftCols<3>() = Rcw;
+  P.col(3) = -Rcw * twc;
+  return K * P;
+}
+
+void ProjectionTable::set(int index, const ProjectionMatrix &P) {
+  if (index < 0)
+    return;
+  if (index >= static_cast<int>(m_valid.size())) {
+    m_matrices.resize(index + 1);
+    m_valid.resize(index + 1, 0);
+  }
+  m_matrices[index] = P;
+  m_valid[index] = 1;
+}
+
+QVector<int> ProjectionTable::indices() const {
+  QVector<int> result;
+  for (int i = 0; i < static_cast<int>(m_valid.size()); ++i) {
+    if (m_valid[i])
+      result.append(i);
+  }
+  return result;
+}
+
+void LinearTriangulator::addView(const ProjectionMatrix &P, double x,
+                                 double y) {
+  Eigen::Matrix<double, 2, 4> rows;
+  rows.row(0) = x * P.row(2) - P.row(0);
+  rows.row(1) = y * P.row(2) - P.row(1);
+  rows.row(0).normalize();
+  rows.row(1).normalize();
+  m_normal.noalias() += rows.transpose() * rows;
+  ++m_numViews;
+}
+
+bool LinearTriangulator::solve(Eigen::Vector3d *xyz) const {
+  if (m_numViews < 2)
+    return false;
+  // Eigenvalues come out in increasing order.
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(m_normal);
+  const Eigen::Vector4d X = solver.eigenvectors().col(0);
+  if (std::abs(X(3)) < 1e-12)
+    return false;
+  *xyz = X.head<3>() / X(3);
+  return true;
+}
+
+bool triangulatePoint(const QMap<int, QPointF> &observations,
+                      const ProjectionTable &projections,
+                      Eigen::Vector3d *xyz) {
+  LinearTriangulator triangulator;
+  for (auto it = observations.cbegin(); it != observations.cend(); ++it) {
+    if (projections.contains(it.key()))
+      triangulator.addView(projections[it.key()], it.value().x(),
+                           it.value().y());
+  }
+  return triangulator.solve(xyz);
+}
+
+TriangulatedPoints
+triangulatePoints(const QMap<int, QMap<int, QPointF>> &tracks,
+                  const ProjectionTable &projections) {
+  TriangulatedPoints result;
+  std::vector<const QMap<int, QPointF> *> observations;
+  observations.reserve(tracks.size());
+  result.setIds.reserve(tracks.size());
+  for (auto it = tracks.cbegin(); it != tracks.cend(); ++it) {
+    result.setIds.append(it.key());
+    observations.push_back(&it.value());
+  }
+  result.points.resize(observations.size());
+  result.valid.resize(observations.size(), 0);
+  parallelFor(static_cast<int>(observations.size()), [&](int i) {
+    result.valid[i] =
+        triangulatePoint(*observations[i], projections, &result.points[i]);
+  });
+  return result;
+}
@@ -0,0 +1,73 @@
+#ifndef TRIANGULATION_H
+#define TRIANGULATION_H
+
+#include <QMap>
+#include <QPointF>
+#include <QVector>
+
+#include <Eigen/Core>
+
+#include <vector>
+
+// Pixel projection K [R | t] of a camera, world to image.
+using ProjectionMatrix = Eigen::Matrix<double, 3, 4>;
+
+// Projection matrix from intrinsics and the world-from-camera rotation and
+// centre, the convention CameraCalibrator reports poses in.
+ProjectionMatrix makeProjectionMatrix(const Eigen::Matrix3d &K,
+                                      const Eigen::Matrix3d &Rwc,
+                                      const Eigen::Vector3d &twc);
+
+// Projection matrices by image index. Images without a pose have none.
+class ProjectionTable {
+public:
+  void set(int index, const ProjectionMatrix &P);
+  bool contains(int index) const {
+    return index >= 0 && index < static_cast<int>(m_valid.size()) &&
+           m_valid[index];
+  }
+  const ProjectionMatrix &operator[](int index) const {
+    return m_matrices[index];
+  }
+  QVector<int> indices() const;
+
+private:
+  std::vector<ProjectionMatrix> m_matrices;
+  std::vector<char> m_valid;
+};
+
+// Linear (DLT) triangulation that accumulates the 4x4 normal matrix of the
+// system one view at a time instead of storing its rows. Each row is
+// normalized first, which keeps the normal matrix well conditioned for
+// pixel-scale projections.
+class LinearTriangulator {
+public:
+  void addView(const ProjectionMatrix &P, double x, double y);
+  int numViews() const { return m_numViews; }
+  // Eigenvector of the smallest eigenvalue, dehomogenized. Fails with fewer
+  // than two views or for a point at infinity.
+  bool solve(Eigen::Vector3d *xyz) const;
+
+private:
+  Eigen::Matrix4d m_normal = Eigen::Matrix4d::Zero();
+  int m_numViews = 0;
+};
+
+// Triangulates one locator from its observations in the images that have a
+// projection.
+bool triangulatePoint(const QMap<int, QPointF> &observations,
+                      const ProjectionTable &projections, Eigen::Vector3d *xyz);
+
+// Triangulates all locators in parallel. Entries follow the key order of
+// tracks; valid[i] tells whether points[i] could be computed.
+struct TriangulatedPoints {
+  QVector<int> setIds;
+  std::vector<Eigen::Vector3d> points;
+  std::vector<char> valid;
+};
+
+TriangulatedPoints
+triangulatePoints(const QMap<int, QMap<int, QPointF>> &tracks,
+                  const ProjectionTable &projections);
+
+#endif // TRIANGULATION_H
@@ -0,0 +1,106 @@
+#include "viewerstats.h"
+#include <algorithm>
+#include <cmath>
+
+ViewerStats::ViewerStats(int window)
+    : m_window(qMax(1, window))
+{
+    reset();
+}
+
+void ViewerStats::record(Counter counter, double ms)
+{
+    Ring &ring = m_rings[counter];
+    if (ring.samples.size() < m_window) {
+        ring.samples.append(ms);
+    } else {
+        ring.samples[ring.next] = ms;
+        ring.next = (ring.next + 1) % m_window;
+    }
+}
+
+void ViewerStats::recordCacheAccess(Cache cache, bool hit)
+{
+    if (hit)
+        ++m_hits[cache];
+    else
+        ++m_misses[cache];
+}
+
+void ViewerStats::reset()
+{
+    for (Ring &ring : m_rings) {
+        ring.samples.clear();
+        ring.next = 0;
+    }
+    std::fill(std::begin(m_hits), std::end(m_hits), 0);
+    std::fill(std::begin(m_misses), std::end(m_misses), 0);
+}
+
+double ViewerStats::percentile(Counter counter, double p) const
+{
+    QVector<double> sorted = m_rings[counter].samples;
+    if (sorted.isEmpty())
+        return 0.0;
+    const int k = qBound(0, int(std::ceil(p / 100.0 * sorted.size())) - 1, sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+int ViewerStats::sampleCount(Counter counter) const
+{
+    return m_rings[counter].samples.size();
+}
+
+double ViewerStats::hitRate(Cache cache) const
+{
+    const quint64 total = cacheAccesses(cache);
+    return total ? double(m_hits[cache]) / total : 0.0;
+}
+
+quint64 ViewerStats::cacheAccesses(Cache cache) const
+{
+    return m_hits[cache] + m_misses[cache];
+}
+
+QString ViewerStats::counterName(Counter counter)
+{
+    switch (counter) {
+    case PaintTime: return QStringLiteral("paint");
+    case ImageConversionTime: return QStringLiteral("convert");
+    case DecodeTime: return QStringLiteral("decode");
+    case MarkerRebuildTime: return QStringLiteral("markers");
+    default: return QString();
+    }
+}
+
+QString ViewerStats::cacheName(Cache cache)
+{
+    switch (cache) {
+    case LabelCache: return QStringLiteral("labels");
+    case PreviewCache: return QStringLiteral("preview");
+    default: return QString();
+    }
+}
+
+QStringList ViewerStats::summary() const
+{
+    QStringList lines;
+    for (int c = 0; c < CounterCount; ++c) {
+        Counter counter = static_cast<Counter>(c);
+        lines << QStringLiteral("%1  p50 %2  p95 %3  p99 %4 ms  (n=%5)")
+                     .arg(counterName(counter), -8)
+                     .arg(percentile(counter, 50), 0, 'f', 2)
+                     .arg(percentile(counter, 95), 0, 'f', 2)
+                     .arg(percentile(counter, 99), 0, 'f', 2)
+                     .arg(sampleCount(counter));
+    }
+    for (int c = 0; c < CacheCount; ++c) {
+        Cache cache = static_cast<Cache>(c);
+        lines << QStringLiteral("%1  hit %2%  (%3)")
+                     .arg(cacheName(cache), -8)
+                     .arg(100.0 * hitRate(cache), 0, 'f', 1)
+                     .arg(cacheAccesses(cache));
+    }
+    return lines;
+}
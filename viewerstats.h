@@ -0,0 +1,55 @@
+#ifndef VIEWERSTATS_H
+#define VIEWERSTATS_H
+
+#include <QStringList>
+#include <QVector>
+
+// Rolling timing counters and cache hit rates for ImageViewer. Each counter
+// keeps the last N samples so percentiles follow what the user sees now;
+// automated UI benchmarks can read the same numbers.
+class ViewerStats
+{
+public:
+    enum Counter {
+        PaintTime,
+        ImageConversionTime,
+        DecodeTime,
+        MarkerRebuildTime,
+        CounterCount
+    };
+
+    enum Cache {
+        LabelCache,
+        PreviewCache,
+        CacheCount
+    };
+
+    explicit ViewerStats(int window = 256);
+
+    void record(Counter counter, double ms);
+    void recordCacheAccess(Cache cache, bool hit);
+    void reset();
+
+    // p is in [0, 100]; returns 0 when no samples were recorded.
+    double percentile(Counter counter, double p) const;
+    int sampleCount(Counter counter) const;
+    double hitRate(Cache cache) const;
+    quint64 cacheAccesses(Cache cache) const;
+
+    static QString counterName(Counter counter);
+    static QString cacheName(Cache cache);
+    QStringList summary() const;
+
+private:
+    struct Ring {
+        QVector<double> samples;
+        int next = 0;
+    };
+
+    int m_window;
+    Ring m_rings[CounterCount];
+    quint64 m_hits[CacheCount];
+    quint64 m_misses[CacheCount];
+};
+
+#endif // VIEWERSTATS_H